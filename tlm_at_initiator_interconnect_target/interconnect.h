@@ -35,18 +35,151 @@
 #ifndef INTERCONNECT_H
 #define INTERCONNECT_H
 #include <iomanip>
+#include <cstdint>
+#include <vector>
 #include <systemc>
 #include <tlm.h>
 #include <tlm_utils/peq_with_cb_and_phase.h>
 #include "../tlm_memory_manager/memory_manager.h"
 #include "../tlm_protocol_checker/tlm2_base_protocol_checker.h"
+#include "../tlm_simple_sockets/address_map.h"
 
 using namespace sc_core;
 using namespace sc_dt;
 
-template<unsigned int I, unsigned int T>
-class interconnect : public sc_module, tlm::tlm_bw_transport_if<>, tlm::tlm_fw_transport_if<>
+// Open-addressing hash table from payload pointers to VALUEs, for state
+// that lives from BEGIN_REQ to the last phase of a transaction. Linear
+// probing with backward-shift deletion needs no tombstones, so the table
+// stays bounded by the number of transactions in flight.
+template<typename VALUE>
+class payloadTable
+{
+    public:
+
+    payloadTable() : slots(16), used(0)
+    {
+    }
+
+    // Entry of the payload, created if it does not exist
+    VALUE &insert(tlm::tlm_generic_payload *key)
+    {
+        if(2 * (used + 1) > slots.size())
+        {
+            grow();
+        }
+
+        size_t i = home(key);
+        while(slots[i].key != 0 && slots[i].key != key)
+        {
+            i = (i + 1) & (slots.size() - 1);
+        }
+        if(slots[i].key == 0)
+        {
+            slots[i].key = key;
+            used++;
+        }
+        return slots[i].value;
+    }
+
+    VALUE *find(tlm::tlm_generic_payload *key)
+    {
+        size_t i = home(key);
+        while(slots[i].key != 0)
+        {
+            if(slots[i].key == key)
+            {
+                return &slots[i].value;
+            }
+            i = (i + 1) & (slots.size() - 1);
+        }
+        return 0;
+    }
+
+    void erase(tlm::tlm_generic_payload *key)
+    {
+        size_t mask = slots.size() - 1;
+        size_t i = home(key);
+        while(slots[i].key != key)
+        {
+            if(slots[i].key == 0)
+            {
+                return;
+            }
+            i = (i + 1) & mask;
+        }
+
+        // Shift back the following entries that would not be found anymore
+        size_t j = i;
+        while(true)
+        {
+            j = (j + 1) & mask;
+            if(slots[j].key == 0)
+            {
+                break;
+            }
+
+            size_t k = home(slots[j].key);
+            bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if(!stays)
+            {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i].key = 0;
+        used--;
+    }
+
+    size_t size() const
+    {
+        return used;
+    }
+
+    private:
+
+    struct slot
+    {
+        tlm::tlm_generic_payload *key;
+        VALUE value;
+
+        slot() : key(0), value()
+        {
+        }
+    };
+
+    std::vector<slot> slots; // power of two
+    size_t used;
+
+    size_t home(tlm::tlm_generic_payload *key) const
+    {
+        // Fibonacci hashing of the pointer, the low bits are aligned
+        uint64_t h = reinterpret_cast<uintptr_t>(key) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h >> 32) & (slots.size() - 1);
+    }
+
+    void grow()
+    {
+        std::vector<slot> old(2 * slots.size());
+        old.swap(slots);
+        used = 0;
+        for(const slot &s : old)
+        {
+            if(s.key != 0)
+            {
+                insert(s.key) = s.value;
+            }
+        }
+    }
+};
+
+// MAP is an addressMap configured with addRegion(), or a staticAddressMap
+// that is fixed at compile time.
+template<unsigned int I, unsigned int T, typename MAP = addressMap>
+class interconnect : public sc_module
 {        
+    static_assert(addressMapPorts<MAP>::HIGHEST < int(I),
+                  "The memory map routes to a port that does not exist");
+
     private:
 
     sc_time randomDelay()
@@ -55,8 +188,17 @@ class interconnect : public sc_module, tlm::tlm_bw_transport_if<>, tlm::tlm_fw_t
         return sc_time(nanoseconds, SC_NS);
     }
     
-    std::map<tlm::tlm_generic_payload*, int> bwRoutingTable;
-    std::map<tlm::tlm_generic_payload*, int> fwRoutingTable;
+    // Route of a transaction between BEGIN_REQ and its last phase
+    struct route
+    {
+        unsigned int inPort;   // From where it comes
+        int outPort;           // Where it should go
+        sc_dt::uint64 address; // Global address, before the translation
+    };
+
+    payloadTable<route> routingTable;
+
+    MAP memoryMap;
 
     // |----- BEGIN REQ ====>|                     | FW
     // |                     |----- BEGIN REQ ---->|
@@ -67,6 +209,63 @@ class interconnect : public sc_module, tlm::tlm_bw_transport_if<>, tlm::tlm_fw_t
     // |----- END RESP =====>|                     |
     // |                     |----- END RESP ----->| FW
 
+    // Every socket is bound to its own port object, which passes the
+    // index of the socket on to the interconnect
+    class targetPort : public tlm::tlm_fw_transport_if<>
+    {
+        public:
+
+        interconnect *owner;
+        unsigned int id;
+
+        void b_transport(tlm::tlm_generic_payload& trans, sc_time& delay)
+        {
+            owner->b_transport(id, trans, delay);
+        }
+
+        tlm::tlm_sync_enum nb_transport_fw(tlm::tlm_generic_payload& trans,
+                                           tlm::tlm_phase& phase,
+                                           sc_time& delay)
+        {
+            return owner->nb_transport_fw(id, trans, phase, delay);
+        }
+
+        bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
+                                tlm::tlm_dmi& dmi_data)
+        {
+            return owner->get_direct_mem_ptr(id, trans, dmi_data);
+        }
+
+        unsigned int transport_dbg(tlm::tlm_generic_payload& trans)
+        {
+            return owner->transport_dbg(id, trans);
+        }
+    };
+
+    class initiatorPort : public tlm::tlm_bw_transport_if<>
+    {
+        public:
+
+        interconnect *owner;
+        unsigned int id;
+
+        tlm::tlm_sync_enum nb_transport_bw(tlm::tlm_generic_payload& trans,
+                                           tlm::tlm_phase& phase,
+                                           sc_time& delay)
+        {
+            return owner->nb_transport_bw(id, trans, phase, delay);
+        }
+
+        void invalidate_direct_mem_ptr(sc_dt::uint64 start_range,
+                                       sc_dt::uint64 end_range)
+        {
+            owner->invalidate_direct_mem_ptr(id, start_range, end_range);
+        }
+    };
+
+    targetPort targetPorts[T];
+    initiatorPort initiatorPorts[I];
+
     public:
 
     tlm::tlm_target_socket<> tSocket[T];
@@ -75,63 +274,93 @@ class interconnect : public sc_module, tlm::tlm_bw_transport_if<>, tlm::tlm_fw_t
     interconnect(sc_module_name name)
         : sc_module(name)
     {
-        for(int i=0; i<I; i++)
+        for(unsigned int i=0; i<I; i++)
         {            
-            iSocket[i].bind(*this);       
+            initiatorPorts[i].owner = this;
+            initiatorPorts[i].id = i;
+            iSocket[i].bind(initiatorPorts[i]);
         }
 
-        for(int i=0; i<T; i++)
+        for(unsigned int i=0; i<T; i++)
         {            
-            tSocket[i].bind(*this);       
+            targetPorts[i].owner = this;
+            targetPorts[i].id = i;
+            tSocket[i].bind(targetPorts[i]);
         }
     }
     SC_HAS_PROCESS(interconnect);    
 
-    int routeFW(int inPort,
-                tlm::tlm_generic_payload &trans,
-                bool store)
+    // Routes size bytes of the global address space starting at base to an
+    // output port, where they appear starting at offset. The memory map is
+    // validated at the end of elaboration.
+    void addRegion(sc_dt::uint64 base,
+                   sc_dt::uint64 size,
+                   int port,
+                   sc_dt::uint64 offset = 0)
     {
-        int outPort = 0;
+        memoryMap.addRegion(base, size, port, offset);
+    }
 
-        // Memory map implementation:
-        if(trans.get_address() < 512)
-        {
-            outPort = 0;
-        }
-        else if(trans.get_address() >= 512 && trans.get_address() < 1024)
-        {
-            // Correct Address:
-            trans.set_address(trans.get_address() - 512);
-            outPort = 1;
-        }
-        else
+    // Number of transactions between BEGIN_REQ and their last phase
+    size_t getTransactionsInFlight() const
+    {
+        return routingTable.size();
+    }
+
+    private:
+
+    void end_of_elaboration()
+    {
+        memoryMap.validate(name(), I);
+    }
+
+    // Decodes the address and translates it into the address space of the
+    // target. Returns 0 and sets an address error for holes in the map.
+    const addressMap::region *routeFW(unsigned int inPort,
+                                      tlm::tlm_generic_payload &trans,
+                                      bool store)
+    {
+        sc_dt::uint64 address = trans.get_address();
+        const addressMap::region *region = memoryMap.decode(address);
+
+        if(region == 0)
         {
             trans.set_response_status( tlm::TLM_ADDRESS_ERROR_RESPONSE );
+            return 0;
         }
 
+        trans.set_address(region->toLocal(address));
+
         if(store)
         {
-            bwRoutingTable[&trans] = inPort;  // From where it comes
-            fwRoutingTable[&trans] = outPort; // Where it should go
+            route &r = routingTable.insert(&trans);
+            r.inPort = inPort;
+            r.outPort = region->port;
+            r.address = address;
         }
 
-        return outPort;
+        return region;
     }
 
-    virtual void b_transport( tlm::tlm_generic_payload& trans,
-                              sc_time& delay )
+    void b_transport(unsigned int id,
+                     tlm::tlm_generic_payload& trans,
+                     sc_time& delay)
     {        
-
-        int outPort = routeFW(id, trans, false);
-        iSocket[outPort]->b_transport(trans, delay);
+        sc_dt::uint64 address = trans.get_address();
+        const addressMap::region *region = routeFW(id, trans, false);
+        if(region)
+        {
+            iSocket[region->port]->b_transport(trans, delay);
+            trans.set_address(address);
+        }
     }
 
 
-    virtual tlm::tlm_sync_enum nb_transport_fw( tlm::tlm_generic_payload& trans,
-                                                tlm::tlm_phase& phase,
-                                                sc_time& delay )
+    tlm::tlm_sync_enum nb_transport_fw(unsigned int id,
+                                       tlm::tlm_generic_payload& trans,
+                                       tlm::tlm_phase& phase,
+                                       sc_time& delay)
     {
-
         sc_assert(id < T);
         int outPort = 0;
 
@@ -144,16 +373,22 @@ class interconnect : public sc_module, tlm::tlm_bw_transport_if<>, tlm::tlm_fw_t
             // set by the interconnect component lying furthest downstream, and
             // so should be regarded as being undefined for the purposes of
             // transaction routing.
-            trans.acquire();
 
             // Modify address accoring to memory map:
-            outPort = routeFW(id, trans, true);
+            const addressMap::region *region = routeFW(id, trans, true);
+            if(region == 0)
+            {
+                // Hole in the memory map: complete with the address error
+                return tlm::TLM_COMPLETED;
+            }
+
+            trans.acquire();
+            outPort = region->port;
         }
         else if(phase == tlm::END_RESP)
         {
             // Adress was already modified in BEGIN_REQ phase:
-            outPort = fwRoutingTable[&trans];
-            trans.release();
+            outPort = routingTable.find(&trans)->outPort;
         }
         else
         {
@@ -170,44 +405,178 @@ class interconnect : public sc_module, tlm::tlm_bw_transport_if<>, tlm::tlm_fw_t
              << " ptr = " << &trans
              << "\033[0m" << endl;
 
+        bool endResponse = (phase == tlm::END_RESP);
+        tlm::tlm_sync_enum r = iSocket[outPort]->nb_transport_fw(trans, phase, delay);
 
-        return iSocket[outPort]->nb_transport_fw(trans, phase, delay);
+        // The target responded on the return path [3.0, 4.0]
+        if(r == tlm::TLM_COMPLETED
+           || (r == tlm::TLM_UPDATED && phase == tlm::BEGIN_RESP))
+        {
+            trans.set_address(routingTable.find(&trans)->address);
+        }
+
+        if(endResponse || r == tlm::TLM_COMPLETED)
+        {
+            completeTransaction(trans);
+        }
+        return r;
     }
 
 
-    virtual tlm::tlm_sync_enum nb_transport_bw( tlm::tlm_generic_payload& trans,
-                                                tlm::tlm_phase& phase,
-                                                sc_time& delay )
+    tlm::tlm_sync_enum nb_transport_bw(unsigned int id,
+                                       tlm::tlm_generic_payload& trans,
+                                       tlm::tlm_phase& phase,
+                                       sc_time& delay)
     {        
+        route *r = routingTable.find(&trans);
+        sc_assert(r && int(id) == r->outPort);
 
-        sc_assert(id == fwRoutingTable[&trans]);
+        // The target is done with the address once it responds, the
+        // initiator may already use it when it handles the response
+        if(phase == tlm::BEGIN_RESP)
+        {
+            trans.set_address(r->address);
+        }
 
-        int inPort = bwRoutingTable[&trans];
+        tlm::tlm_sync_enum status =
+            tSocket[r->inPort]->nb_transport_bw(trans, phase, delay);
+
+        // The initiator completed on the return path [2.1, 3.1]
+        if(status == tlm::TLM_COMPLETED
+           || (status == tlm::TLM_UPDATED && phase == tlm::END_RESP))
+        {
+            completeTransaction(trans);
+        }
+        return status;
+    }
 
-        return tSocket[inPort]->nb_transport_bw(trans, phase, delay);
+    // The transaction has passed its last phase: forget its route and drop
+    // the reference of BEGIN_REQ
+    void completeTransaction(tlm::tlm_generic_payload& trans)
+    {
+        routingTable.erase(&trans);
+        trans.release();
     }
 
     // TLM-2 forward DMI method
-    virtual bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
-                                    tlm::tlm_dmi& dmi_data)
+    bool get_direct_mem_ptr(unsigned int id,
+                            tlm::tlm_generic_payload& trans,
+                            tlm::tlm_dmi& dmi_data)
     {
-        // Dummy method
-        return false;
+        sc_dt::uint64 address = trans.get_address();
+        const addressMap::region *region = memoryMap.decode(address);
+
+        if(region == 0)
+        {
+            // Hole in the memory map, nothing to grant
+            dmi_data.allow_none();
+            dmi_data.set_start_address(address);
+            dmi_data.set_end_address(address);
+            return false;
+        }
+
+        trans.set_address(region->toLocal(address));
+        bool granted = iSocket[region->port]->get_direct_mem_ptr(trans,
+                                                                 dmi_data);
+        trans.set_address(address);
+
+        // Clip the target's range to the region and translate it back into
+        // the global memory map
+        sc_dt::uint64 start = dmi_data.get_start_address();
+        sc_dt::uint64 end = dmi_data.get_end_address();
+        sc_dt::uint64 regionEnd = region->offset + (region->size - 1);
+        if(start < region->offset)
+        {
+            if(granted)
+            {
+                dmi_data.set_dmi_ptr(dmi_data.get_dmi_ptr()
+                                     + (region->offset - start));
+            }
+            start = region->offset;
+        }
+        if(end > regionEnd)
+        {
+            end = regionEnd;
+        }
+        if(end < start)
+        {
+            dmi_data.allow_none();
+            return false;
+        }
+        dmi_data.set_start_address(region->toGlobal(start));
+        dmi_data.set_end_address(region->toGlobal(end));
+
+        return granted;
     }
 
     // TLM-2 debug transport method
-    virtual unsigned int transport_dbg(tlm::tlm_generic_payload& trans)
+    unsigned int transport_dbg(unsigned int id, tlm::tlm_generic_payload& trans)
     {
-        // Dummy method
-        return 0;
+        sc_dt::uint64 address = trans.get_address();
+        unsigned char *data = trans.get_data_ptr();
+        unsigned int length = trans.get_data_length();
+        unsigned int count = 0;
+
+        // A debug access may span several targets: it is split at the
+        // region boundaries and stops at a hole or a short transfer
+        while(count < length)
+        {
+            const addressMap::region *region = memoryMap.decode(address
+                                                                + count);
+            if(region == 0)
+            {
+                break;
+            }
+
+            unsigned int chunk = length - count;
+            if(chunk > region->end() - (address + count) + 1)
+            {
+                chunk = region->end() - (address + count) + 1;
+            }
+            trans.set_address(region->toLocal(address + count));
+            trans.set_data_ptr(data + count);
+            trans.set_data_length(chunk);
+
+            unsigned int transferred =
+                iSocket[region->port]->transport_dbg(trans);
+            count += transferred;
+            if(transferred < chunk)
+            {
+                break;
+            }
+        }
+
+        trans.set_address(address);
+        trans.set_data_ptr(data);
+        trans.set_data_length(length);
+        return count;
     }
 
     // TLM-2 backward DMI method
-    virtual void invalidate_direct_mem_ptr(sc_dt::uint64 start_range,
-                                           sc_dt::uint64 end_range)
+    void invalidate_direct_mem_ptr(unsigned int id,
+                                   sc_dt::uint64 start_range,
+                                   sc_dt::uint64 end_range)
     {
-        // Dummy method
+        // Translate the target's range into every region that maps it
+        for(const addressMap::region &region : memoryMap.getRegions())
+        {
+            sc_dt::uint64 regionEnd = region.offset + (region.size - 1);
+            if(region.port != int(id)
+               || start_range > regionEnd || end_range < region.offset)
+            {
+                continue;
+            }
+
+            sc_dt::uint64 start = std::max(start_range, region.offset);
+            sc_dt::uint64 end = std::min(end_range, regionEnd);
+
+            for(unsigned int i=0; i<T; i++)
+            {
+                tSocket[i]->invalidate_direct_mem_ptr(region.toGlobal(start),
+                                                      region.toGlobal(end));
+            }
+        }
     }
 };
 
-#endif
\ No newline at end of file
+#endif
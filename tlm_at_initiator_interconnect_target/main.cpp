@@ -15,7 +15,12 @@ int sc_main (int, char **)
     memory<512> memory0("memory0");
     memory<512> memory1("memory1");
 
-    interconnect<2,2> bus("bus0");
+    // Memory map: two 512 byte regions, each at address 0 of its memory.
+    // It is fixed at compile time and decoded with a shift and an index.
+    typedef staticAddressMap<staticRegion<0, 512, 0>,
+                             staticRegion<512, 512, 1> > memoryMap;
+
+    interconnect<2,2,memoryMap> bus("bus0");
 
     cpu0.iSocket.bind(bus.tSocket[0]);
     cpu1.iSocket.bind(bus.tSocket[1]);
@@ -39,5 +44,7 @@ int sc_main (int, char **)
     sc_start();
 
     std::cout << std::endl;
+    cpu0.printStatistics(std::cout);
+    cpu1.printStatistics(std::cout);
     return 0;
 }
@@ -65,18 +65,24 @@ class memory : public sc_module, tlm::tlm_fw_transport_if<>
 
     unsigned char *mem;     
 
+    // Latencies announced to initiators that access mem through DMI
+    sc_time dmiReadLatency;
+    sc_time dmiWriteLatency;
+
     public:
 
     tlm::tlm_target_socket<> tSocket;
 
     memory(sc_module_name name)
         : sc_module(name),
-        tSocket("memory socket"),
         transactionInProgress(0),
         responseInProgress(false),
         nextResponsePending(0),
         endRequestPending(0),
-        peq(this, &memory::peqCallback)
+        peq(this, &memory::peqCallback),
+        dmiReadLatency(10, SC_NS),
+        dmiWriteLatency(10, SC_NS),
+        tSocket("memory socket")
     {
         tSocket.bind(*this);
         mem = new unsigned char[SIZE];
@@ -179,8 +185,7 @@ class memory : public sc_module, tlm::tlm_fw_transport_if<>
         bw_phase = tlm::END_REQ;
         delay = randomDelay(); // Accept delay
 
-        tlm::tlm_sync_enum status;
-        status = tSocket->nb_transport_bw( trans, bw_phase, delay ); // [1.2]
+        tSocket->nb_transport_bw( trans, bw_phase, delay ); // [1.2]
         // Ignore return value (has to be TLM_ACCEPTED anyway)
         // initiator cannot terminate transaction at this point
 
@@ -260,6 +265,8 @@ class memory : public sc_module, tlm::tlm_fw_transport_if<>
              << " Data = " << ptr[0] << ptr[1] << ptr[2] << ptr[3]
              << "\033[0m" << endl;
 
+        // Hint to the initiator that it can use DMI for this address
+        trans.set_dmi_allowed(true);
         trans.set_response_status(tlm::TLM_OK_RESPONSE);
     }
 
@@ -294,15 +301,42 @@ class memory : public sc_module, tlm::tlm_fw_transport_if<>
     virtual bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
                                     tlm::tlm_dmi& dmi_data)
     {
-        // Dummy method
-        return false;
+        // The whole memory array is granted for reading and writing
+        dmi_data.set_dmi_ptr(mem);
+        dmi_data.set_start_address(0);
+        dmi_data.set_end_address(SIZE - 1);
+        dmi_data.set_read_latency(dmiReadLatency);
+        dmi_data.set_write_latency(dmiWriteLatency);
+        dmi_data.allow_read_write();
+        return true;
     }
 
-    // TLM-2 debug transport method
+    // TLM-2 debug transport method: zero-time bulk access of any length,
+    // clipped to the end of the memory
     virtual unsigned int transport_dbg(tlm::tlm_generic_payload& trans)
     {
-        // Dummy method
-        return 0;
+        tlm::tlm_command cmd = trans.get_command();
+        sc_dt::uint64    adr = trans.get_address();
+        unsigned int     len = trans.get_data_length();
+
+        if (adr >= SIZE || cmd == tlm::TLM_IGNORE_COMMAND)
+        {
+            return 0;
+        }
+        if (len > SIZE - adr)
+        {
+            len = SIZE - adr;
+        }
+
+        if (cmd == tlm::TLM_WRITE_COMMAND)
+        {
+            memcpy(&mem[adr], trans.get_data_ptr(), len);
+        }
+        else
+        {
+            memcpy(trans.get_data_ptr(), &mem[adr], len);
+        }
+        return len;
     }
 };
 
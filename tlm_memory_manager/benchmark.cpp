@@ -0,0 +1,233 @@
+/*
+ * Copyright 2024 Kamel Fakih
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Authors:
+ *     - Kamel Fakih
+ */
+
+// Microbenchmark for the memory manager.
+//
+// Every variant allocates a batch of payloads (the pool size, i.e. the
+// number of transactions in flight), acquires them and releases them again
+// in LIFO, FIFO or random order. The batch is repeated until the requested
+// number of operations is reached. Results are written as CSV, one line
+// per variant, release order and pool size:
+//
+//   variant,order,pool_size,operations,allocate_ns,release_ns,mops
+//
+// allocate_ns and release_ns are the mean latencies of allocate+acquire
+// and release per payload, mops is the throughput of complete
+// allocate/release cycles in millions per second.
+//
+// Usage: tlm_memory_manager_benchmark [operations] [output.csv]
+//
+// Without an output file the results go to stdout. Set the environment
+// variable SYSTEMC_DISABLE_COPYRIGHT_MESSAGE=DISABLE to keep the SystemC
+// banner out of the CSV.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <systemc.h>
+#include <tlm.h>
+
+#include "memory_manager.h"
+
+using namespace std;
+
+static const unsigned int DATA_LENGTH = 64;
+
+enum releaseOrder { LIFO, FIFO, RANDOM };
+
+static const char* orderName(releaseOrder order)
+{
+    switch(order) {
+        case LIFO: return "lifo";
+        case FIFO: return "fifo";
+        default:   return "random";
+    }
+}
+
+// Index sequence in which a batch of payloads is released
+static vector<unsigned int> releaseSequence(releaseOrder order,
+                                            unsigned int poolSize)
+{
+    vector<unsigned int> sequence(poolSize);
+    for(unsigned int i = 0; i < poolSize; i++) {
+        sequence[i] = i;
+    }
+
+    if(order == LIFO) {
+        reverse(sequence.begin(), sequence.end());
+    } else if(order == RANDOM) {
+        default_random_engine randGenerator(poolSize);
+        shuffle(sequence.begin(), sequence.end(), randGenerator);
+    }
+
+    return sequence;
+}
+
+template<typename ALLOCATE, typename RELEASE>
+static void run(ostream& out,
+                const char* variant,
+                ALLOCATE allocate,
+                RELEASE release,
+                unsigned long long operations)
+{
+    typedef chrono::steady_clock clock;
+
+    const unsigned int poolSizes[] = {1, 16, 256, 4096};
+    const releaseOrder orders[] = {LIFO, FIFO, RANDOM};
+
+    for(releaseOrder order: orders) {
+        for(unsigned int poolSize: poolSizes) {
+            vector<unsigned int> sequence = releaseSequence(order, poolSize);
+            vector<gp*> batch(poolSize);
+
+            // Warm-up round, fills free lists and buffer pools:
+            for(unsigned int i = 0; i < poolSize; i++) {
+                batch[i] = allocate();
+            }
+            for(unsigned int i: sequence) {
+                release(batch[i]);
+            }
+
+            unsigned long long rounds = max(1ULL, operations / poolSize);
+            clock::duration allocateTime(0);
+            clock::duration releaseTime(0);
+
+            for(unsigned long long r = 0; r < rounds; r++) {
+                clock::time_point start = clock::now();
+                for(unsigned int i = 0; i < poolSize; i++) {
+                    batch[i] = allocate();
+                }
+                clock::time_point middle = clock::now();
+                for(unsigned int i: sequence) {
+                    release(batch[i]);
+                }
+                clock::time_point end = clock::now();
+
+                allocateTime += middle - start;
+                releaseTime += end - middle;
+            }
+
+            double count = double(rounds) * poolSize;
+            double allocateNs = chrono::duration<double, nano>(
+                                    allocateTime).count() / count;
+            double releaseNs = chrono::duration<double, nano>(
+                                    releaseTime).count() / count;
+
+            out << variant << ","
+                << orderName(order) << ","
+                << poolSize << ","
+                << (unsigned long long)count << ","
+                << allocateNs << ","
+                << releaseNs << ","
+                << 1000.0 / (allocateNs + releaseNs) << endl;
+        }
+    }
+}
+
+int sc_main (int sc_argc, char *sc_argv[])
+{
+    unsigned long long operations = 1 << 20;
+    if(sc_argc > 1) {
+        operations = strtoull(sc_argv[1], 0, 10);
+    }
+
+    ofstream file;
+    if(sc_argc > 2) {
+        file.open(sc_argv[2]);
+        if(!file) {
+            cerr << "Cannot open " << sc_argv[2] << endl;
+            return 1;
+        }
+    }
+    ostream& out = file.is_open() ? file : cout;
+
+    out << "variant,order,pool_size,operations,"
+        << "allocate_ns,release_ns,mops" << endl;
+
+    // Baseline: every transaction is a heap allocation
+    run(out, "new_delete",
+        []() { return new gp(); },
+        [](gp* payload) { delete payload; },
+        operations);
+
+    run(out, "new_delete_buffer",
+        []() {
+            gp* payload = new gp();
+            payload->set_data_ptr(new unsigned char[DATA_LENGTH]);
+            return payload;
+        },
+        [](gp* payload) {
+            delete[] payload->get_data_ptr();
+            delete payload;
+        },
+        operations);
+
+    MemoryManager heapMM;
+    run(out, "mm_heap",
+        [&]() { gp* payload = heapMM.allocate(); payload->acquire();
+                return payload; },
+        [](gp* payload) { payload->release(); },
+        operations);
+
+    MemoryManager slabMM(256);
+    run(out, "mm_slab",
+        [&]() { gp* payload = slabMM.allocate(); payload->acquire();
+                return payload; },
+        [](gp* payload) { payload->release(); },
+        operations);
+
+    MemoryManager bufferMM(256);
+    run(out, "mm_slab_buffer",
+        [&]() { gp* payload = bufferMM.allocate(DATA_LENGTH);
+                payload->acquire();
+                return payload; },
+        [](gp* payload) { payload->release(); },
+        operations);
+
+    MemoryManager sharedMM(256);
+    PayloadCache cache(sharedMM, 16);
+    run(out, "mm_cache_buffer",
+        [&]() { gp* payload = cache.allocate(DATA_LENGTH);
+                payload->acquire();
+                return payload; },
+        [](gp* payload) { payload->release(); },
+        operations);
+
+    return 0;
+}
@@ -59,5 +59,16 @@ int sc_main (int __attribute__((unused)) sc_argc,
     trans->release();
     trans->release();
 
+    // Slab mode with warm-up: the payloads are carved out of one block
+    MemoryManager slabMM(64);
+    slabMM.reserve(64);
+
+    trans = slabMM.allocate();
+    trans->acquire();
+    trans->release();
+
+    mm.printStatistics(std::cout, "mm");
+    slabMM.printStatistics(std::cout, "slabMM");
+
     return 0;
 }
@@ -34,38 +34,382 @@
  *    Matthias Jung
  */
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <new>
 
 #include "memory_manager.h"
 
 using namespace std;
 
-MemoryManager::MemoryManager(): numberOfAllocations(0), numberOfFrees(0)
+// Payload as handed out by the MemoryManager. It remembers which pooled
+// buffers are attached to it, because the initiator may redirect the data
+// pointer of the payload to a buffer of its own.
+class pooledPayload : public gp
+{
+  public:
+    pooledPayload(tlm::tlm_mm_interface* mm) : gp(mm),
+                                               dataBuffer(0),
+                                               dataClass(0),
+                                               byteEnableBuffer(0),
+                                               byteEnableClass(0)
+    {
+    }
+
+    unsigned char* dataBuffer;
+    unsigned int dataClass;
+    unsigned char* byteEnableBuffer;
+    unsigned int byteEnableClass;
+};
+
+// Smallest buffer size class handed out (8 bytes):
+static const unsigned int MIN_SIZE_CLASS = 3;
+
+// Largest pooled size class (2 GiB). Longer buffers are allocated and
+// deleted one by one, since 1u << 32 does not fit into an unsigned int:
+static const unsigned int MAX_SIZE_CLASS = 31;
+static const unsigned int UNPOOLED = MAX_SIZE_CLASS + 1;
+
+// Payloads in a slab are padded to whole cache lines, so that two payloads
+// never share a line:
+static const size_t CACHE_LINE_SIZE = 64;
+static const size_t PAYLOAD_STRIDE = ((sizeof(pooledPayload) + CACHE_LINE_SIZE - 1)
+                                      / CACHE_LINE_SIZE) * CACHE_LINE_SIZE;
+
+MemoryManager::MemoryManager(unsigned int slabSize, unsigned int capacity):
+    statistics(),
+    slabSize(slabSize),
+    slabCursor(0),
+    slabEnd(0),
+    capacity(capacity),
+    waitingAllocators(0),
+    freeBuffers(MAX_SIZE_CLASS + 1)
 {
 }
 
 MemoryManager::~MemoryManager()
 {
-    for(gp* payload: freePayloads) {
-        delete payload;
-        numberOfFrees++;
+    if(slabSize == 0) {
+        for(gp* payload: freePayloads) {
+            delete static_cast<pooledPayload*>(payload);
+        }
+    } else {
+        // Bulk teardown: destroy every payload that was carved out of a
+        // slab and hand back each slab with a single call.
+        for(unsigned char* slab: slabs) {
+            unsigned char* end = (slab == slabs.back()) ? slabCursor
+                               : slab + slabSize * PAYLOAD_STRIDE;
+            for(unsigned char* slot = slab; slot < end;
+                slot += PAYLOAD_STRIDE) {
+                pooledPayload* payload =
+                        reinterpret_cast<pooledPayload*>(slot);
+                releaseBuffers(payload);
+                payload->~pooledPayload();
+            }
+            std::free(slab);
+        }
+    }
+
+    for(std::vector<unsigned char*>& pool: freeBuffers) {
+        for(unsigned char* buffer: pool) {
+            delete[] buffer;
+        }
+    }
+}
+
+gp* MemoryManager::create()
+{
+    statistics.created++;
+
+    if(slabSize == 0) {
+        statistics.bytesHeld += sizeof(pooledPayload);
+        return new pooledPayload(this);
     }
+
+    if(slabCursor == slabEnd) {
+        void* slab = 0;
+        if(posix_memalign(&slab, CACHE_LINE_SIZE,
+                          slabSize * PAYLOAD_STRIDE) != 0) {
+            throw std::bad_alloc();
+        }
+        slabs.push_back(static_cast<unsigned char*>(slab));
+        statistics.bytesHeld += slabSize * PAYLOAD_STRIDE;
+        slabCursor = static_cast<unsigned char*>(slab);
+        slabEnd = slabCursor + slabSize * PAYLOAD_STRIDE;
+    }
+
+    // Pointer bump inside the current slab:
+    gp* result = new (slabCursor) pooledPayload(this);
+    slabCursor += PAYLOAD_STRIDE;
+    return result;
+}
+
+bool MemoryManager::exhausted() const
+{
+    return freePayloads.empty()
+        && capacity != 0
+        && statistics.created >= capacity;
 }
 
 gp* MemoryManager::allocate()
 {
-    if(freePayloads.empty()) {
-        numberOfAllocations++;
-        return new gp(this);
+    if(exhausted()) {
+        statistics.exhausted++;
+
+        sc_core::sc_curr_proc_kind kind =
+                sc_core::sc_get_current_process_handle().proc_kind();
+
+        if(kind != sc_core::SC_THREAD_PROC_
+           && kind != sc_core::SC_CTHREAD_PROC_) {
+            // A warning, not an error: the default actions of an error
+            // throw, and the caller is promised a null pointer
+            SC_REPORT_WARNING("MemoryManager",
+                              "Capacity exhausted outside of a thread");
+            return 0;
+        }
+
+        // Back-pressure: suspend the initiator until a payload comes back
+        waitingAllocators++;
+        while(exhausted()) {
+            sc_core::wait(payloadFreed);
+        }
+        waitingAllocators--;
+    }
+
+    return tryAllocate();
+}
+
+gp* MemoryManager::tryAllocate()
+{
+    gp* result;
+
+    if(exhausted()) {
+        statistics.exhausted++;
+        return 0;
+    } else if(freePayloads.empty()) {
+        statistics.freeListMisses++;
+        result = create();
     } else {
-        gp* result = freePayloads.back();
+        statistics.freeListHits++;
+        result = freePayloads.back();
         freePayloads.pop_back();
-        return result;
+    }
+
+    if(++statistics.outstanding > statistics.peakOutstanding) {
+        statistics.peakOutstanding = statistics.outstanding;
+    }
+    return result;
+}
+
+gp* MemoryManager::allocate(unsigned int dataLength, bool byteEnable)
+{
+    gp* payload = allocate();
+    if(payload != 0) {
+        attachBuffers(payload, dataLength, byteEnable);
+    }
+    return payload;
+}
+
+void MemoryManager::attachBuffers(gp* p,
+                                  unsigned int dataLength,
+                                  bool byteEnable)
+{
+    pooledPayload* payload = static_cast<pooledPayload*>(p);
+
+    unsigned int sizeClass = UNPOOLED;
+    if(dataLength <= (1u << MAX_SIZE_CLASS)) {
+        sizeClass = MIN_SIZE_CLASS;
+        while((1u << sizeClass) < dataLength) {
+            sizeClass++;
+        }
+    }
+
+    payload->dataClass = sizeClass;
+    payload->dataBuffer = takeBuffer(sizeClass, dataLength);
+    payload->set_data_ptr(payload->dataBuffer);
+    payload->set_data_length(dataLength);
+    payload->set_streaming_width(dataLength);
+
+    if(byteEnable) {
+        payload->byteEnableClass = sizeClass;
+        payload->byteEnableBuffer = takeBuffer(sizeClass, dataLength);
+        memset(payload->byteEnableBuffer, tlm::TLM_BYTE_ENABLED, dataLength);
+        payload->set_byte_enable_ptr(payload->byteEnableBuffer);
+        payload->set_byte_enable_length(dataLength);
+    } else {
+        payload->set_byte_enable_ptr(0);
+        payload->set_byte_enable_length(0);
     }
 }
 
 void MemoryManager::free(gp* payload)
 {
-    payload->reset(); //clears all extensions
+    recycle(payload);
+    giveBack(payload);
+}
+
+void MemoryManager::recycle(gp* payload)
+{
+    releaseBuffers(payload);
+    payload->reset(); //clears auto extensions, sticky ones are reused
+}
+
+void MemoryManager::giveBack(gp* payload)
+{
     freePayloads.push_back(payload);
+    statistics.outstanding--;
+
+    if(waitingAllocators) {
+        payloadFreed.notify();
+    }
+}
+
+unsigned char* MemoryManager::takeBuffer(unsigned int sizeClass,
+                                         unsigned int length)
+{
+    if(sizeClass == UNPOOLED) {
+        return new unsigned char[length];
+    }
+
+    std::vector<unsigned char*>& pool = freeBuffers[sizeClass];
+    if(pool.empty()) {
+        statistics.bytesHeld += 1u << sizeClass;
+        return new unsigned char[1u << sizeClass];
+    } else {
+        unsigned char* result = pool.back();
+        pool.pop_back();
+        return result;
+    }
+}
+
+void MemoryManager::giveBackBuffer(unsigned int sizeClass,
+                                   unsigned char* buffer)
+{
+    if(sizeClass == UNPOOLED) {
+        delete[] buffer;
+    } else {
+        freeBuffers[sizeClass].push_back(buffer);
+    }
+}
+
+void MemoryManager::releaseBuffers(gp* payload)
+{
+    pooledPayload* p = static_cast<pooledPayload*>(payload);
+
+    if(p->dataBuffer) {
+        giveBackBuffer(p->dataClass, p->dataBuffer);
+        p->dataBuffer = 0;
+        p->set_data_ptr(0);
+    }
+
+    if(p->byteEnableBuffer) {
+        giveBackBuffer(p->byteEnableClass, p->byteEnableBuffer);
+        p->byteEnableBuffer = 0;
+        p->set_byte_enable_ptr(0);
+    }
+}
+
+void MemoryManager::reserve(unsigned int n)
+{
+    if(capacity != 0 && n > capacity) {
+        n = capacity;
+    }
+
+    if(n <= statistics.created) {
+        return;
+    }
+
+    // Size the free list once, so that free() never reallocates it:
+    freePayloads.reserve(n);
+
+    size_t first = freePayloads.size();
+    while(statistics.created < n) {
+        freePayloads.push_back(create());
+    }
+
+    // Hand out the new payloads in address order:
+    std::reverse(freePayloads.begin() + first, freePayloads.end());
+}
+
+const MemoryManager::Statistics& MemoryManager::getStatistics() const
+{
+    return statistics;
+}
+
+void MemoryManager::printStatistics(std::ostream& os, const char* name) const
+{
+    uint64_t allocations = statistics.freeListHits + statistics.freeListMisses;
+    double reuse = allocations ? 100.0 * statistics.freeListHits / allocations
+                               : 0.0;
+
+    os << name << ": created = " << statistics.created
+       << ", outstanding = " << statistics.outstanding
+       << ", peak = " << statistics.peakOutstanding
+       << ", hits = " << statistics.freeListHits
+       << ", misses = " << statistics.freeListMisses
+       << ", exhausted = " << statistics.exhausted
+       << ", reuse = " << reuse << "%"
+       << ", bytes held = " << statistics.bytesHeld << endl;
+}
+
+PayloadCache::PayloadCache(MemoryManager& pool, unsigned int size):
+    pool(pool),
+    size(size)
+{
+    cachedPayloads.reserve(size);
+}
+
+PayloadCache::~PayloadCache()
+{
+    for(gp* payload: cachedPayloads) {
+        payload->set_mm(&pool);
+        pool.giveBack(payload);
+    }
+}
+
+gp* PayloadCache::allocate()
+{
+    if(!cachedPayloads.empty()) {
+        gp* result = cachedPayloads.back();
+        cachedPayloads.pop_back();
+        return result;
+    }
+
+    // Route the final release() of the payload through this cache:
+    gp* result = pool.allocate();
+    if(result != 0) {
+        result->set_mm(this);
+    }
+    return result;
+}
+
+gp* PayloadCache::allocate(unsigned int dataLength, bool byteEnable)
+{
+    gp* payload = allocate();
+    if(payload != 0) {
+        pool.attachBuffers(payload, dataLength, byteEnable);
+    }
+    return payload;
+}
+
+void PayloadCache::free(gp* payload)
+{
+    pool.recycle(payload);
+
+    // A capacity-limited pool may have allocators waiting, or get them
+    // later, while idle payloads sit in this cache. They would never see
+    // these payloads, so they go straight back.
+    if(cachedPayloads.size() < size && pool.capacity == 0) {
+        cachedPayloads.push_back(payload);
+    } else {
+        payload->set_mm(&pool);
+        pool.giveBack(payload);
+    }
+}
+
+MemoryManager& PayloadCache::getPool()
+{
+    return pool;
 }
@@ -37,8 +37,11 @@
 #ifndef MEMORY_MANAGER_H
 #define MEMORY_MANAGER_H
 
+#include <systemc>
 #include <tlm.h>
 
+#include <cstdint>
+#include <iostream>
 #include <vector>
 
 typedef tlm::tlm_generic_payload gp;
@@ -46,15 +49,97 @@ typedef tlm::tlm_generic_payload gp;
 class MemoryManager : public tlm::tlm_mm_interface
 {
   public:
-    MemoryManager();
+    struct Statistics
+    {
+        uint64_t created;         // payloads constructed so far
+        uint64_t outstanding;     // payloads currently handed out
+        uint64_t peakOutstanding; // high-water mark of outstanding
+        uint64_t freeListHits;    // allocations served from the free list
+        uint64_t freeListMisses;  // allocations that created a payload
+        uint64_t exhausted;       // allocations that hit the capacity
+        uint64_t bytesHeld;       // payloads, slabs and pooled buffers
+    };
+
+    // With slabSize > 0 payloads are carved out of contiguous, cache-line
+    // aligned slabs holding slabSize payloads each instead of being
+    // allocated one by one on the heap.
+    //
+    // With capacity > 0 at most capacity payloads are created. When all of
+    // them are in use, allocate() suspends the calling SC_THREAD until a
+    // payload is freed; outside of a thread it reports a warning and
+    // returns a null pointer, like tryAllocate() does.
+    MemoryManager(unsigned int slabSize = 0, unsigned int capacity = 0);
     virtual ~MemoryManager();
     virtual gp* allocate();
     virtual void free(gp* payload);
 
+    // Non-blocking allocation, returns a null pointer on exhaustion
+    gp* tryAllocate();
+
+    // Payload with an attached data buffer of dataLength bytes (and, on
+    // request, a byte enable buffer of the same length with all bytes
+    // enabled). The buffers are drawn from power-of-two size-class pools
+    // and go back to them automatically when the payload is freed. Buffers
+    // above 2 GiB are not pooled.
+    gp* allocate(unsigned int dataLength, bool byteEnable = false);
+
+    // Warm-up: makes sure that at least n payloads exist, so that the
+    // first n allocations do not touch the heap.
+    void reserve(unsigned int n);
+
+    const Statistics& getStatistics() const;
+    void printStatistics(std::ostream& os = std::cout,
+                         const char* name = "MemoryManager") const;
+
   private:
-    unsigned int numberOfAllocations;
-    unsigned int numberOfFrees;
+    friend class PayloadCache;
+
+    gp* create();
+    bool exhausted() const;
+    void attachBuffers(gp* payload, unsigned int dataLength, bool byteEnable);
+    unsigned char* takeBuffer(unsigned int sizeClass, unsigned int length);
+    void giveBackBuffer(unsigned int sizeClass, unsigned char* buffer);
+    void releaseBuffers(gp* payload);
+    void recycle(gp* payload);
+    void giveBack(gp* payload);
+
+    Statistics statistics;
     std::vector<gp*> freePayloads;
+
+    unsigned int slabSize;
+    std::vector<unsigned char*> slabs;
+    unsigned char* slabCursor;
+    unsigned char* slabEnd;
+
+    unsigned int capacity;
+    unsigned int waitingAllocators;
+    sc_core::sc_event payloadFreed;
+
+    // Free buffers, indexed by size class (buffer size = 1 << class):
+    std::vector<std::vector<unsigned char*> > freeBuffers;
+};
+
+// Small per-initiator cache in front of a MemoryManager that is shared by
+// many initiators. Freed payloads are kept locally up to the cache size and
+// go back to the shared pool beyond that, so the total number of payloads
+// follows the transactions in flight rather than the number of initiators.
+// Payloads held by a cache count as outstanding in the pool statistics.
+// In front of a pool with a capacity the cache keeps no payloads, so
+// initiators blocked in MemoryManager::allocate() get every freed payload.
+class PayloadCache : public tlm::tlm_mm_interface
+{
+  public:
+    PayloadCache(MemoryManager& pool, unsigned int size = 4);
+    virtual ~PayloadCache();
+    gp* allocate();
+    gp* allocate(unsigned int dataLength, bool byteEnable = false);
+    virtual void free(gp* payload);
+    MemoryManager& getPool();
+
+  private:
+    MemoryManager& pool;
+    unsigned int size;
+    std::vector<gp*> cachedPayloads;
 };
 
 #endif // MEMORY_MANAGER_H
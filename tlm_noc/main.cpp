@@ -0,0 +1,198 @@
+/*
+ * Copyright 2024 Kamel Fakih
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Authors:
+ *     - Kamel Fakih
+ */
+
+
+// Network-on-chip example: routers built from the interconnect of
+// tlm_simple_sockets in arbitrated mode, with one traffic generator and one
+// memory per node. Every generator sends uniformly distributed 8 byte reads
+// and writes to the memories of all nodes, so requests and responses cross
+// the average number of hops of the topology. One CSV line is written per
+// run:
+//
+//   topology,nodes,average_hops,transactions,simulated_ns,wall_s,ktps,
+//   bytes_per_ns,latency_ns
+//
+// ktps is the simulator throughput in thousand transactions per wall clock
+// second, bytes_per_ns the modeled bandwidth of all nodes together and
+// latency_ns the mean time from BEGIN_REQ to BEGIN_RESP.
+//
+// Usage: tlm_noc mesh <width> <height> [transactions per node]
+//        tlm_noc ring <nodes> [transactions per node]
+//
+// All counts must be positive, a ring has at least 3 and a network at most
+// 65536 nodes.
+//
+// Set the environment variable SYSTEMC_DISABLE_COPYRIGHT_MESSAGE=DISABLE to
+// keep the SystemC banner out of the CSV.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <systemc.h>
+#include <tlm.h>
+
+#include "../tlm_simple_sockets/memory.h"
+#include "topology.h"
+#include "traffic_generator.h"
+
+using namespace std;
+
+static const unsigned int REGION_SIZE = 4096;
+
+// Positive number of nodes or transactions, 0 if the argument is invalid
+static unsigned int count(const char* argument)
+{
+    char* end;
+    long value = strtol(argument, &end, 10);
+    if(*argument == 0 || *end != 0 || value <= 0 || value > 1000000000L) {
+        return 0;
+    }
+    return value;
+}
+
+static int usage()
+{
+    cerr << "Usage: tlm_noc mesh <width> <height> [transactions]" << endl
+         << "       tlm_noc ring <nodes> [transactions]" << endl;
+    return 1;
+}
+
+int sc_main (int sc_argc, char *sc_argv[])
+{
+    if(sc_argc < 3) {
+        return usage();
+    }
+
+    string shape = sc_argv[1];
+    unsigned int width = count(sc_argv[2]);
+    unsigned int height = 1;
+    int next = 3;
+    if(shape == "mesh") {
+        height = (sc_argc >= 4) ? count(sc_argv[3]) : 0;
+        next = 4;
+    } else if(shape != "ring") {
+        return usage();
+    }
+
+    unsigned int transactions = 1000;
+    if(sc_argc > next) {
+        transactions = count(sc_argv[next]);
+    }
+
+    // Nodes are counted in 32 bits and own REGION_SIZE bytes each
+    if(width == 0 || height == 0 || transactions == 0
+       || (unsigned long long)width * height > 65536) {
+        return usage();
+    }
+
+    topology *noc;
+    if(shape == "mesh") {
+        noc = topology::mesh(width, height, REGION_SIZE);
+    } else {
+        noc = topology::ring(width, REGION_SIZE);
+    }
+
+    unsigned int nodes = noc->getNodes();
+    noc->setTracing(false);
+
+    // All generators allocate their transactions from one shared pool
+    MemoryManager pool;
+    vector<trafficGenerator*> generators;
+    vector<memory<REGION_SIZE, alignedAccess>*> memories;
+
+    for(unsigned int node = 0; node < nodes; node++) {
+        string suffix = to_string(node);
+        generators.push_back(new trafficGenerator(
+                ("generator" + suffix).c_str(), pool,
+                noc->getAddressRange(), transactions, 4,
+                sc_time(10, SC_NS), node));
+        // Aligned accesses to a flat store take the untraced fast path
+        memories.push_back(new memory<REGION_SIZE, alignedAccess>(
+                ("memory" + suffix).c_str(), 0, 4, 4));
+
+        noc->bindInitiator(node, generators[node]->iSocket);
+        noc->bindTarget(node, memories[node]->tSocket);
+    }
+
+    // Uniform traffic reaches every node with the same probability
+    double hops = 0;
+    for(unsigned int from = 0; from < nodes; from++) {
+        for(unsigned int to = 0; to < nodes; to++) {
+            hops += noc->getHops(from, to);
+        }
+    }
+    hops /= double(nodes) * nodes;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    sc_start();
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+    unsigned long long completed = 0;
+    unsigned long long bytes = 0;
+    sc_time latency = SC_ZERO_TIME;
+    for(trafficGenerator* generator: generators) {
+        completed += generator->getCompleted();
+        bytes += generator->getBytes();
+        latency += generator->getTotalLatency();
+    }
+
+    if(completed != (unsigned long long)transactions * nodes) {
+        SC_REPORT_WARNING("tlm_noc", "Not all transactions completed");
+    }
+
+    double wall = chrono::duration<double>(end - start).count();
+    double simulated = sc_time_stamp().to_seconds() * 1e9;
+
+    cout << "topology,nodes,average_hops,transactions,simulated_ns,"
+         << "wall_s,ktps,bytes_per_ns,latency_ns" << endl;
+    cout << shape << ","
+         << nodes << ","
+         << hops << ","
+         << completed << ","
+         << simulated << ","
+         << wall << ","
+         << completed / wall / 1000.0 << ","
+         << bytes / simulated << ","
+         << (completed ? latency.to_seconds() * 1e9 / completed : 0.0)
+         << endl;
+
+    for(unsigned int node = 0; node < nodes; node++) {
+        delete generators[node];
+        delete memories[node];
+    }
+    delete noc;
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright 2024 Kamel Fakih
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Authors:
+ *     - Kamel Fakih
+ */
+
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+#include <string>
+#include <vector>
+#include <systemc.h>
+#include <tlm.h>
+
+#include "../tlm_simple_sockets/interconnect.h"
+
+// Network of chained interconnects (routers) with one initiator and one
+// target per node. Node n owns the global address range
+// [n * regionSize, (n + 1) * regionSize), which its target sees starting at
+// address 0. The routers forward the ranges of the other nodes unchanged to
+// the next hop, each hop keeps its own frame in the routingExtension.
+//
+// The builder creates the routers, binds the links between them and
+// programs their address maps. Afterwards exactly one initiator and one
+// target have to be bound to every node, their ports follow the link ports.
+class topology
+{
+public:
+    // width x height mesh, node x + y * width, with dimension-order (XY)
+    // routing, which is free of deadlocks
+    static topology *mesh(unsigned int width,
+                          unsigned int height,
+                          sc_dt::uint64 regionSize,
+                          arbitrationPolicy policy = ROUND_ROBIN)
+    {
+        if (width == 0 || height == 0)
+        {
+            SC_REPORT_FATAL("topology", "A mesh needs at least 1x1 nodes");
+        }
+
+        topology *t = new topology(MESH, width * height, width,
+                                   regionSize, policy);
+        for (unsigned int y = 0; y < height; y++)
+        {
+            for (unsigned int x = 0; x < width; x++)
+            {
+                unsigned int node = x + y * width;
+                if (x + 1 < width)
+                {
+                    t->link(node, node + 1);
+                }
+                if (y + 1 < height)
+                {
+                    t->link(node, node + width);
+                }
+            }
+        }
+        t->programRoutes();
+        return t;
+    }
+
+    // Bidirectional ring with shortest path routing, except that node 0 is
+    // never passed in transit. This breaks the cyclic dependency between
+    // the links of each direction, a ring would deadlock otherwise.
+    static topology *ring(unsigned int nodes,
+                          sc_dt::uint64 regionSize,
+                          arbitrationPolicy policy = ROUND_ROBIN)
+    {
+        if (nodes < 3)
+        {
+            SC_REPORT_FATAL("topology", "A ring needs at least 3 nodes");
+        }
+
+        topology *t = new topology(RING, nodes, 0, regionSize, policy);
+        for (unsigned int node = 0; node < nodes; node++)
+        {
+            t->link(node, (node + 1) % nodes);
+        }
+        t->programRoutes();
+        return t;
+    }
+
+    ~topology()
+    {
+        for (interconnect *router : routers)
+        {
+            delete router;
+        }
+    }
+
+    template <typename SOCKET>
+    void bindInitiator(unsigned int node, SOCKET &socket)
+    {
+        socket.bind(routers[node]->tSocket);
+    }
+
+    template <typename SOCKET>
+    void bindTarget(unsigned int node, SOCKET &socket)
+    {
+        routers[node]->iSocket.bind(socket);
+    }
+
+    void setTracing(bool enable)
+    {
+        for (interconnect *router : routers)
+        {
+            router->setTracing(enable);
+        }
+    }
+
+    unsigned int getNodes() const
+    {
+        return routers.size();
+    }
+
+    interconnect &getRouter(unsigned int node)
+    {
+        return *routers[node];
+    }
+
+    sc_dt::uint64 getBase(unsigned int node) const
+    {
+        return node * regionSize;
+    }
+
+    sc_dt::uint64 getAddressRange() const
+    {
+        return routers.size() * regionSize;
+    }
+
+    // Number of links between the routers of two nodes
+    unsigned int getHops(unsigned int from, unsigned int to) const
+    {
+        unsigned int hops = 0;
+        for (; from != to; hops++)
+        {
+            from = nextHop(from, to);
+        }
+        return hops;
+    }
+
+private:
+    enum kind {MESH, RING};
+
+    kind shape;
+    unsigned int width; // of a mesh
+    sc_dt::uint64 regionSize;
+    std::vector<interconnect*> routers;
+    // Neighbours of every node, in the order of the link ports
+    std::vector<std::vector<unsigned int> > neighbours;
+
+    topology(kind shape,
+             unsigned int nodes,
+             unsigned int width,
+             sc_dt::uint64 regionSize,
+             arbitrationPolicy policy) :
+        shape(shape),
+        width(width),
+        regionSize(regionSize),
+        neighbours(nodes)
+    {
+        for (unsigned int node = 0; node < nodes; node++)
+        {
+            std::string name = "router" + std::to_string(node);
+            routers.push_back(new interconnect(name.c_str(), policy));
+        }
+    }
+
+    void link(unsigned int a, unsigned int b)
+    {
+        routers[a]->iSocket.bind(routers[b]->tSocket);
+        routers[b]->iSocket.bind(routers[a]->tSocket);
+        neighbours[a].push_back(b);
+        neighbours[b].push_back(a);
+    }
+
+    unsigned int nextHop(unsigned int node, unsigned int destination) const
+    {
+        if (shape == MESH)
+        {
+            unsigned int x = node % width;
+            unsigned int y = node / width;
+            unsigned int dx = destination % width;
+            unsigned int dy = destination / width;
+
+            if (dx != x)
+            {
+                return dx > x ? node + 1 : node - 1;
+            }
+            return dy > y ? node + width : node - width;
+        }
+
+        unsigned int nodes = routers.size();
+        unsigned int up = (destination + nodes - node) % nodes;
+        unsigned int down = (node + nodes - destination) % nodes;
+        // Paths that would pass node 0 in transit
+        bool upAllowed = !(node != 0 && destination != 0 && destination < node);
+        bool downAllowed = !(node != 0 && destination > node);
+
+        if (upAllowed && (up <= down || !downAllowed))
+        {
+            return (node + 1) % nodes;
+        }
+        return (node + nodes - 1) % nodes;
+    }
+
+    int outPort(unsigned int node, unsigned int destination) const
+    {
+        unsigned int next = nextHop(node, destination);
+        for (unsigned int port = 0; port < neighbours[node].size(); port++)
+        {
+            if (neighbours[node][port] == next)
+            {
+                return port;
+            }
+        }
+        return -1;
+    }
+
+    // The range of the node itself goes to the local target port, the
+    // ranges of the other nodes to the link towards them. Consecutive
+    // ranges that leave through the same link are merged into one region.
+    void programRoutes()
+    {
+        unsigned int nodes = routers.size();
+
+        for (unsigned int node = 0; node < nodes; node++)
+        {
+            int local = neighbours[node].size();
+            unsigned int first = 0;
+
+            for (unsigned int d = 1; d <= nodes; d++)
+            {
+                if (d < nodes && d != node && first != node
+                    && outPort(node, d) == outPort(node, first))
+                {
+                    continue;
+                }
+
+                if (first == node)
+                {
+                    routers[node]->addRegion(getBase(node), regionSize,
+                                             local, 0);
+                }
+                else
+                {
+                    routers[node]->addRegion(getBase(first),
+                                             (d - first) * regionSize,
+                                             outPort(node, first),
+                                             getBase(first));
+                }
+                first = d;
+            }
+        }
+    }
+};
+
+#endif // TOPOLOGY_H
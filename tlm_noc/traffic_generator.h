@@ -0,0 +1,251 @@
+/*
+ * Copyright 2024 Kamel Fakih
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Authors:
+ *     - Kamel Fakih
+ */
+
+
+#ifndef TRAFFIC_GENERATOR_H
+#define TRAFFIC_GENERATOR_H
+#include <random>
+#include <systemc>
+#include <tlm.h>
+#include <tlm_utils/peq_with_cb_and_phase.h>
+#include <tlm_utils/simple_initiator_socket.h>
+#include "../tlm_memory_manager/memory_manager.h"
+
+using namespace sc_core;
+using namespace sc_dt;
+
+// Time of BEGIN_REQ, carried by the payload. Like the routingExtension it is
+// sticky: created the first time a pooled payload is used and overwritten
+// in place afterwards, so that measuring the latency does not allocate.
+class issueTimeExtension : public tlm::tlm_extension<issueTimeExtension>
+{
+public:
+    sc_time time;
+
+    tlm_extension_base *clone() const
+    {
+        return new issueTimeExtension(*this);
+    }
+
+    void copy_from(const tlm_extension_base &ext)
+    {
+        time = static_cast<const issueTimeExtension &>(ext).time;
+    }
+};
+
+// AT initiator that issues random, naturally aligned 8 byte reads and
+// writes to the whole address range, at most one per interval and up to
+// outstanding transactions at a time. It counts the completed transactions,
+// their bytes and their latency from BEGIN_REQ to BEGIN_RESP.
+SC_MODULE(trafficGenerator)
+{
+    public:
+
+    tlm_utils::simple_initiator_socket<trafficGenerator> iSocket;
+
+    trafficGenerator(sc_module_name name,
+                     MemoryManager &pool,
+                     sc_dt::uint64 addressRange,
+                     unsigned int transactions,
+                     unsigned int outstanding = 4,
+                     sc_time interval = sc_time(10, SC_NS),
+                     unsigned int seed = 0)
+        : sc_module(name),
+        iSocket("iSocket"),
+        mm(pool),
+        addressRange(addressRange),
+        transactions(transactions),
+        maxOutstanding(outstanding),
+        interval(interval),
+        seed(seed),
+        requestInProgress(0),
+        outstanding(0),
+        completed(0),
+        bytes(0),
+        peq(this, &trafficGenerator::peqCallback)
+    {
+        iSocket.register_nb_transport_bw(this,
+                &trafficGenerator::nb_transport_bw);
+        SC_THREAD(generate);
+    }
+    SC_HAS_PROCESS(trafficGenerator);
+
+    unsigned int getCompleted() const
+    {
+        return completed;
+    }
+
+    unsigned long long getBytes() const
+    {
+        return bytes;
+    }
+
+    sc_time getTotalLatency() const
+    {
+        return totalLatency;
+    }
+
+    private:
+
+    PayloadCache mm;
+    sc_dt::uint64 addressRange;
+    unsigned int transactions;
+    unsigned int maxOutstanding;
+    sc_time interval;
+    unsigned int seed;
+
+    tlm::tlm_generic_payload* requestInProgress;
+    unsigned int outstanding;
+    sc_event endRequest;
+    sc_event endResponse;
+
+    unsigned int completed;
+    unsigned long long bytes;
+    sc_time totalLatency;
+
+    tlm_utils::peq_with_cb_and_phase<trafficGenerator> peq;
+
+    void generate()
+    {
+        std::default_random_engine randGenerator(seed);
+        std::uniform_int_distribution<uint64_t> distrWord(0,
+                addressRange / 8 - 1);
+        std::bernoulli_distribution distrWrite(0.5);
+
+        for (unsigned int i = 0; i < transactions; i++)
+        {
+            while (outstanding >= maxOutstanding)
+            {
+                wait(endResponse);
+            }
+
+            // BEGIN_REQ/END_REQ exclusion rule
+            while (requestInProgress)
+            {
+                wait(endRequest);
+            }
+
+            tlm::tlm_generic_payload* trans = mm.allocate(8);
+            trans->acquire();
+            trans->set_command(distrWrite(randGenerator)
+                               ? tlm::TLM_WRITE_COMMAND
+                               : tlm::TLM_READ_COMMAND);
+            trans->set_address(distrWord(randGenerator) * 8);
+            trans->set_byte_enable_ptr(0);
+            trans->set_dmi_allowed(false);
+            trans->set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+            memcpy(trans->get_data_ptr(), &i, sizeof(i));
+
+            issueTimeExtension* issue = nullptr;
+            trans->get_extension(issue);
+            if (issue == nullptr)
+            {
+                issue = new issueTimeExtension;
+                trans->set_extension(issue);
+            }
+            issue->time = sc_time_stamp();
+
+            outstanding++;
+            requestInProgress = trans;
+
+            tlm::tlm_phase phase = tlm::BEGIN_REQ;
+            sc_time delay = SC_ZERO_TIME;
+            tlm::tlm_sync_enum status;
+            status = iSocket->nb_transport_fw(*trans, phase, delay);
+
+            if (status == tlm::TLM_UPDATED) // [2.0] or [4.0]
+            {
+                peq.notify(*trans, phase, delay);
+            }
+            else if (status == tlm::TLM_COMPLETED) // [3.0]
+            {
+                requestInProgress = 0;
+                finishTransaction(*trans);
+            }
+
+            wait(interval);
+        }
+    }
+
+    tlm::tlm_sync_enum nb_transport_bw(tlm::tlm_generic_payload& trans,
+                                       tlm::tlm_phase& phase,
+                                       sc_time& delay)
+    {
+        peq.notify(trans, phase, delay);
+        return tlm::TLM_ACCEPTED;
+    }
+
+    void peqCallback(tlm::tlm_generic_payload& trans,
+                     const tlm::tlm_phase& phase)
+    {
+        if (phase == tlm::END_REQ
+            || (&trans == requestInProgress && phase == tlm::BEGIN_RESP))
+        {
+            requestInProgress = 0;
+            endRequest.notify();
+        }
+        else if (phase == tlm::BEGIN_REQ || phase == tlm::END_RESP)
+        {
+            SC_REPORT_FATAL(name(), "Illegal transaction phase received");
+        }
+
+        if (phase == tlm::BEGIN_RESP)
+        {
+            tlm::tlm_phase fwPhase = tlm::END_RESP;
+            sc_time delay = SC_ZERO_TIME;
+            iSocket->nb_transport_fw(trans, fwPhase, delay); // Ignore return
+
+            finishTransaction(trans);
+        }
+    }
+
+    void finishTransaction(tlm::tlm_generic_payload& trans)
+    {
+        if (trans.is_response_error())
+        {
+            SC_REPORT_ERROR(name(), trans.get_response_string().c_str());
+        }
+
+        completed++;
+        bytes += trans.get_data_length();
+        issueTimeExtension* issue = nullptr;
+        trans.get_extension(issue);
+        totalLatency += sc_time_stamp() - issue->time;
+
+        outstanding--;
+        endResponse.notify();
+        trans.release();
+    }
+};
+
+#endif // TRAFFIC_GENERATOR_H
@@ -0,0 +1,347 @@
+/*
+ * Copyright 2024 Kamel Fakih
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Authors:
+ *     - Kamel Fakih
+ */
+
+#ifndef ADDRESS_MAP_H
+#define ADDRESS_MAP_H
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include <systemc>
+
+// Memory map of an interconnect. Every region routes size bytes of the
+// global address space starting at base to an output port, where they
+// appear starting at offset. The regions are kept sorted by base, so that
+// decode() is a binary search, preceded by a check of the last region hit
+// since consecutive transactions mostly go to the same target.
+class addressMap
+{
+    public:
+
+    struct region
+    {
+        sc_dt::uint64 base;
+        sc_dt::uint64 size;
+        int port;
+        sc_dt::uint64 offset;
+
+        sc_dt::uint64 end() const
+        {
+            return base + size - 1;
+        }
+
+        bool contains(sc_dt::uint64 address) const
+        {
+            return address >= base && address - base < size;
+        }
+
+        // Global address to the address in the target and back
+        sc_dt::uint64 toLocal(sc_dt::uint64 address) const
+        {
+            return address - base + offset;
+        }
+
+        sc_dt::uint64 toGlobal(sc_dt::uint64 address) const
+        {
+            return address - offset + base;
+        }
+    };
+
+    addressMap() : lastHit(0)
+    {
+    }
+
+    void addRegion(sc_dt::uint64 base,
+                   sc_dt::uint64 size,
+                   int port,
+                   sc_dt::uint64 offset = 0)
+    {
+        if (size == 0 || base + (size - 1) < base)
+        {
+            SC_REPORT_ERROR("addressMap", "Invalid region size");
+            return;
+        }
+
+        // The map can be decoded right away, e.g. by debug transport or
+        // b_transport before the simulation starts
+        region r = {base, size, port, offset};
+        std::vector<sc_dt::uint64>::iterator position =
+            std::upper_bound(bases.begin(), bases.end(), base);
+        regions.insert(regions.begin() + (position - bases.begin()), r);
+        bases.insert(position, base);
+        lastHit = 0;
+    }
+
+    // Diagnostics at the end of elaboration: overlapping regions and ports
+    // that do not exist are errors, gaps between regions are warnings.
+    void validate(const char *owner, unsigned int ports)
+    {
+        if (regions.empty())
+        {
+            SC_REPORT_ERROR(owner, "Empty memory map");
+        }
+
+        for (size_t i = 0; i < regions.size(); i++)
+        {
+            const region &r = regions[i];
+            if (r.port < 0 || static_cast<unsigned int>(r.port) >= ports)
+            {
+                SC_REPORT_ERROR(owner, ("Region " + describe(r)
+                                + " is routed to an unbound port").c_str());
+            }
+
+            if (i == 0)
+            {
+                continue;
+            }
+
+            const region &previous = regions[i - 1];
+            if (r.base <= previous.end())
+            {
+                SC_REPORT_ERROR(owner, ("Region " + describe(r)
+                                + " overlaps " + describe(previous)).c_str());
+            }
+            else if (r.base != previous.end() + 1)
+            {
+                SC_REPORT_WARNING(owner, ("Gap between " + describe(previous)
+                                  + " and " + describe(r)).c_str());
+            }
+        }
+    }
+
+    // Region that contains address, or 0 for a hole in the map
+    const region *decode(sc_dt::uint64 address)
+    {
+        if (lastHit && lastHit->contains(address))
+        {
+            return lastHit;
+        }
+
+        // Last region whose base is not above the address
+        std::vector<sc_dt::uint64>::const_iterator it =
+            std::upper_bound(bases.begin(), bases.end(), address);
+        if (it == bases.begin())
+        {
+            return 0;
+        }
+
+        const region &r = regions[(it - bases.begin()) - 1];
+        if (!r.contains(address))
+        {
+            return 0;
+        }
+
+        lastHit = &r;
+        return lastHit;
+    }
+
+    const std::vector<region> &getRegions() const
+    {
+        return regions;
+    }
+
+    private:
+
+    std::vector<region> regions;
+    std::vector<sc_dt::uint64> bases; // copy of the bases for the search
+    const region *lastHit;
+
+    static std::string describe(const region &r)
+    {
+        std::ostringstream text;
+        text << "[0x" << std::hex << r.base << ", 0x" << r.end()
+             << "] -> port " << std::dec << r.port;
+        return text.str();
+    }
+};
+
+// Region of a staticAddressMap
+template <sc_dt::uint64 BASE,
+          sc_dt::uint64 SIZE,
+          int PORT,
+          sc_dt::uint64 OFFSET = 0>
+struct staticRegion
+{
+    static_assert(SIZE > 0 && BASE + (SIZE - 1) >= BASE,
+                  "Invalid region size");
+    static_assert(PORT >= 0, "Invalid port");
+
+    static const sc_dt::uint64 base = BASE;
+    static const sc_dt::uint64 size = SIZE;
+    static const int port = PORT;
+    static const sc_dt::uint64 offset = OFFSET;
+};
+
+// Memory map fixed at compile time, with the interface of addressMap.
+// REGIONS must be sorted by base and must not overlap, otherwise the map
+// does not compile. If the regions tile the address space from 0 in equal
+// sizes of a power of two, decode() is a shift and an index, otherwise a
+// chain of comparisons unrolled by the compiler.
+template <typename... REGIONS>
+class staticAddressMap
+{
+    public:
+
+    static const size_t COUNT = sizeof...(REGIONS);
+
+    static_assert(COUNT > 0, "Empty memory map");
+
+    private:
+
+    static constexpr bool sorted()
+    {
+        const sc_dt::uint64 bases[] = {REGIONS::base...};
+        const sc_dt::uint64 sizes[] = {REGIONS::size...};
+        for (size_t i = 1; i < COUNT; i++)
+        {
+            if (bases[i] <= bases[i - 1] + (sizes[i - 1] - 1))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static constexpr bool uniform()
+    {
+        const sc_dt::uint64 bases[] = {REGIONS::base...};
+        const sc_dt::uint64 sizes[] = {REGIONS::size...};
+        if ((sizes[0] & (sizes[0] - 1)) != 0)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            if (sizes[i] != sizes[0] || bases[i] != i * sizes[0])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static constexpr unsigned int shift()
+    {
+        const sc_dt::uint64 sizes[] = {REGIONS::size...};
+        unsigned int bits = 0;
+        while ((sc_dt::uint64(1) << bits) < sizes[0])
+        {
+            bits++;
+        }
+        return bits;
+    }
+
+    static constexpr int highestPort()
+    {
+        const int ports[] = {REGIONS::port...};
+        int highest = 0;
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            highest = (ports[i] > highest) ? ports[i] : highest;
+        }
+        return highest;
+    }
+
+    public:
+
+    static_assert(sorted(),
+                  "Regions must be sorted by base and must not overlap");
+
+    static const bool UNIFORM = uniform();
+    static const unsigned int SHIFT = shift();
+    static const int HIGHEST_PORT = highestPort();
+
+    staticAddressMap()
+        : regions({{REGIONS::base, REGIONS::size,
+                    REGIONS::port, REGIONS::offset}...})
+    {
+    }
+
+    // The memory map is fixed at compile time, so adding a region to it
+    // does not compile
+    void addRegion(sc_dt::uint64, sc_dt::uint64, int, sc_dt::uint64) = delete;
+
+    // Everything was checked by the compiler, see addressMapPorts
+    void validate(const char *, unsigned int)
+    {
+    }
+
+    const addressMap::region *decode(sc_dt::uint64 address) const
+    {
+        if (UNIFORM)
+        {
+            sc_dt::uint64 index = address >> SHIFT;
+            return (index < COUNT) ? &regions[index] : 0;
+        }
+        return find<0, REGIONS...>(address);
+    }
+
+    const std::vector<addressMap::region> &getRegions() const
+    {
+        return regions;
+    }
+
+    private:
+
+    std::vector<addressMap::region> regions;
+
+    template <size_t N>
+    const addressMap::region *find(sc_dt::uint64) const
+    {
+        return 0;
+    }
+
+    template <size_t N, typename REGION, typename... REST>
+    const addressMap::region *find(sc_dt::uint64 address) const
+    {
+        if (address - REGION::base < REGION::size)
+        {
+            return &regions[N];
+        }
+        return find<N + 1, REST...>(address);
+    }
+};
+
+// Highest port a memory map routes to, if it is known at compile time
+template <typename MAP>
+struct addressMapPorts
+{
+    static const int HIGHEST = -1; // checked by validate() at elaboration
+};
+
+template <typename... REGIONS>
+struct addressMapPorts<staticAddressMap<REGIONS...> >
+{
+    static const int HIGHEST = staticAddressMap<REGIONS...>::HIGHEST_PORT;
+};
+
+#endif // ADDRESS_MAP_H
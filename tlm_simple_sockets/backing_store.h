@@ -0,0 +1,1431 @@
+/*
+ * Copyright 2024 Kamel Fakih
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Authors:
+ *     - Kamel Fakih
+ */
+
+#ifndef BACKING_STORE_H
+#define BACKING_STORE_H
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <systemc>
+
+// 0xff for every byte of word that is 0xff, 0x00 for every other byte
+inline uint64_t enabledBytes(uint64_t word)
+{
+    const uint64_t low7 = 0x7f7f7f7f7f7f7f7full;
+    uint64_t disabled = ~word; // zero bytes are enabled
+    // Top bit of every byte set if the byte of disabled is not zero, without
+    // carries between the bytes
+    uint64_t nonZero = ((disabled & low7) + low7) | disabled;
+    return ((~nonZero & ~low7) >> 7) * 0xff;
+}
+
+// Copies length bytes from src to dst, but only those whose byte enable is
+// 0xff, as in TLM-2 any other value disables the byte. The byte enable mask
+// repeats every maskLength bytes and is applied starting at maskOffset.
+// Eight byte enables read at once are turned into the mask of a 64-bit
+// word, so contiguous stretches of the mask are merged word by word instead
+// of byte by byte.
+inline void maskedCopy(unsigned char *dst,
+                       const unsigned char *src,
+                       unsigned int length,
+                       const unsigned char *mask,
+                       unsigned int maskLength,
+                       unsigned int maskOffset)
+{
+    unsigned int i = 0;
+    while (i < length)
+    {
+        unsigned int m = (maskOffset + i) % maskLength;
+        unsigned int run = length - i;
+        if (run > maskLength - m)
+        {
+            run = maskLength - m;
+        }
+
+        unsigned int j = 0;
+        for (; j + 8 <= run; j += 8)
+        {
+            uint64_t d, v, e;
+            memcpy(&d, dst + i + j, 8);
+            memcpy(&v, src + i + j, 8);
+            memcpy(&e, mask + m + j, 8);
+            e = enabledBytes(e);
+            d = (d & ~e) | (v & e);
+            memcpy(dst + i + j, &d, 8);
+        }
+        for (; j < run; j++)
+        {
+            if (mask[m + j] == 0xff)
+            {
+                dst[i + j] = src[i + j];
+            }
+        }
+
+        i += run;
+    }
+}
+
+// True if the length bytes at data are all zero
+inline bool isZero(const unsigned char *data, sc_dt::uint64 length)
+{
+    sc_dt::uint64 i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        if (word != 0)
+        {
+            return false;
+        }
+    }
+    for (; i < length; i++)
+    {
+        if (data[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Run-length codec for pages of 64-bit words, suited for zero-filled and
+// pattern-filled memory. The output is a sequence of tokens: a 16-bit
+// header, whose top bit marks a run and whose other bits hold the number
+// of words minus one, followed by the repeated word or the literal words.
+// compressWords() returns the output length, or 0 if it would exceed
+// capacity.
+inline unsigned int compressWords(const unsigned char *in,
+                                  unsigned int words,
+                                  unsigned char *out,
+                                  unsigned int capacity)
+{
+    unsigned int length = 0;
+    unsigned int i = 0;
+    while (i < words)
+    {
+        unsigned int count = 1;
+        bool run = i + 1 < words && memcmp(in + 8 * i, in + 8 * (i + 1), 8) == 0;
+        if (run)
+        {
+            while (i + count < words && count < 0x8000
+                   && memcmp(in + 8 * i, in + 8 * (i + count), 8) == 0)
+            {
+                count++;
+            }
+        }
+        else
+        {
+            // Literal words up to the start of the next run
+            while (i + count < words && count < 0x8000
+                   && !(i + count + 1 < words
+                        && memcmp(in + 8 * (i + count),
+                                  in + 8 * (i + count + 1), 8) == 0))
+            {
+                count++;
+            }
+        }
+
+        unsigned int payload = run ? 8 : 8 * count;
+        if (length + 2 + payload > capacity)
+        {
+            return 0;
+        }
+
+        uint16_t header = (run ? 0x8000 : 0) | (count - 1);
+        memcpy(out + length, &header, 2);
+        memcpy(out + length + 2, in + 8 * i, payload);
+        length += 2 + payload;
+        i += count;
+    }
+    return length;
+}
+
+inline void decompressWords(const unsigned char *in,
+                            unsigned int length,
+                            unsigned char *out)
+{
+    unsigned int position = 0;
+    while (position < length)
+    {
+        uint16_t header;
+        memcpy(&header, in + position, 2);
+        unsigned int count = (header & 0x7fff) + 1;
+        position += 2;
+
+        if (header & 0x8000)
+        {
+            for (unsigned int i = 0; i < count; i++)
+            {
+                memcpy(out + 8 * i, in + position, 8);
+            }
+            position += 8;
+        }
+        else
+        {
+            memcpy(out, in + position, 8 * count);
+            position += 8 * count;
+        }
+        out += 8 * count;
+    }
+}
+
+// Storage behind a memory model, addressed by 64-bit byte offsets.
+//
+// Checkpoints are files with a header (magic, version, page size, store
+// size) followed by one record (page index, page contents) for each page
+// of CHECKPOINT_PAGE bytes that is not all zeros. Pages missing in the
+// file are zero when it is loaded.
+class backingStore
+{
+    public:
+
+    static const unsigned int CHECKPOINT_PAGE = 4096;
+
+    virtual ~backingStore() {}
+
+    virtual sc_dt::uint64 size() const = 0;
+
+    virtual void read(sc_dt::uint64 address,
+                      unsigned char *data,
+                      unsigned int length) = 0;
+
+    virtual void write(sc_dt::uint64 address,
+                       const unsigned char *data,
+                       unsigned int length) = 0;
+
+    // Byte-enabled accesses, see maskedCopy(). By default they go through
+    // a bounce buffer with read() and write().
+    virtual void readMasked(sc_dt::uint64 address,
+                            unsigned char *data,
+                            unsigned int length,
+                            const unsigned char *mask,
+                            unsigned int maskLength,
+                            unsigned int maskOffset)
+    {
+        unsigned char buffer[256];
+        while (length > 0)
+        {
+            unsigned int chunk = (length < sizeof(buffer)) ? length
+                                                           : sizeof(buffer);
+            read(address, buffer, chunk);
+            maskedCopy(data, buffer, chunk, mask, maskLength, maskOffset);
+            address += chunk;
+            data += chunk;
+            length -= chunk;
+            maskOffset += chunk;
+        }
+    }
+
+    virtual void writeMasked(sc_dt::uint64 address,
+                             const unsigned char *data,
+                             unsigned int length,
+                             const unsigned char *mask,
+                             unsigned int maskLength,
+                             unsigned int maskOffset)
+    {
+        unsigned char buffer[256];
+        while (length > 0)
+        {
+            unsigned int chunk = (length < sizeof(buffer)) ? length
+                                                           : sizeof(buffer);
+            read(address, buffer, chunk);
+            maskedCopy(buffer, data, chunk, mask, maskLength, maskOffset);
+            write(address, buffer, chunk);
+            address += chunk;
+            data += chunk;
+            length -= chunk;
+            maskOffset += chunk;
+        }
+    }
+
+    // Host pointer to the contiguous block [start, end] that contains
+    // address, e.g. for DMI. Returns 0 if the store cannot provide one.
+    virtual unsigned char *directPointer(sc_dt::uint64 address,
+                                         sc_dt::uint64 &start,
+                                         sc_dt::uint64 &end)
+    {
+        return 0;
+    }
+
+    // Like directPointer(), but for DMI reads: stores that allocate on write
+    // may hand out data that is shared, e.g. zeros for absent pages.
+    // writable tells whether the block may be written as well.
+    virtual unsigned char *readPointer(sc_dt::uint64 address,
+                                       sc_dt::uint64 &start,
+                                       sc_dt::uint64 &end,
+                                       bool &writable)
+    {
+        writable = true;
+        return directPointer(address, start, end);
+    }
+
+    // A write replaces shared data behind read-only blocks of readPointer().
+    // Returns true once after such writes, with the range [start, end] that
+    // covers them, so that the pointers can be invalidated.
+    virtual bool staleReadPointers(sc_dt::uint64 &start, sc_dt::uint64 &end)
+    {
+        return false;
+    }
+
+    // Called at the end of simulation, e.g. to persist the contents. That
+    // requires sc_stop(), stores that persist also flush on destruction.
+    virtual void flush()
+    {
+    }
+
+    // Sets the whole store to zero
+    virtual void clear() = 0;
+
+    // Reduces the host memory held by the contents, e.g. by sharing equal
+    // pages. Returns the number of bytes held afterwards.
+    virtual sc_dt::uint64 compact()
+    {
+        return size();
+    }
+
+    // In-process snapshots of the contents. takeSnapshot() returns a handle
+    // for restoreSnapshot(), which may be called any number of times until
+    // releaseSnapshot(). Only stores with copy-on-write pages support them.
+    virtual unsigned int takeSnapshot()
+    {
+        SC_REPORT_ERROR("backingStore", "Snapshots require a pagedStore");
+        return 0;
+    }
+
+    virtual void restoreSnapshot(unsigned int snapshot)
+    {
+        SC_REPORT_ERROR("backingStore", "Snapshots require a pagedStore");
+    }
+
+    virtual void releaseSnapshot(unsigned int snapshot)
+    {
+        SC_REPORT_ERROR("backingStore", "Snapshots require a pagedStore");
+    }
+
+    bool saveCheckpoint(const std::string &path)
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (file == 0)
+        {
+            SC_REPORT_ERROR("backingStore", ("Cannot open " + path).c_str());
+            return false;
+        }
+
+        checkpointHeader header = {{'S','C','V','P','C','K','P','T'},
+                                   1, CHECKPOINT_PAGE, size()};
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+        unsigned char page[CHECKPOINT_PAGE];
+        sc_dt::uint64 pages = (size() + CHECKPOINT_PAGE - 1) / CHECKPOINT_PAGE;
+        for (sc_dt::uint64 index = nextPage(0);
+             ok && index < pages;
+             index = nextPage(index + 1))
+        {
+            unsigned int length = pageLength(index);
+            read(index * CHECKPOINT_PAGE, page, length);
+            if (isZero(page, length))
+            {
+                continue;
+            }
+            ok = fwrite(&index, sizeof(index), 1, file) == 1
+              && fwrite(page, length, 1, file) == 1;
+        }
+
+        if (fclose(file) != 0 || !ok)
+        {
+            SC_REPORT_ERROR("backingStore", ("Cannot write " + path).c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool loadCheckpoint(const std::string &path)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == 0)
+        {
+            SC_REPORT_ERROR("backingStore", ("Cannot open " + path).c_str());
+            return false;
+        }
+
+        checkpointHeader header;
+        if (fread(&header, sizeof(header), 1, file) != 1
+            || memcmp(header.magic, "SCVPCKPT", 8) != 0
+            || header.version != 1
+            || header.pageSize != CHECKPOINT_PAGE
+            || header.size != size())
+        {
+            SC_REPORT_ERROR("backingStore",
+                            ("Incompatible checkpoint " + path).c_str());
+            fclose(file);
+            return false;
+        }
+
+        // Validate all records before the contents are replaced, so that
+        // a truncated or corrupt file leaves the store untouched
+        long records = ftell(file);
+        sc_dt::uint64 pages = (size() + CHECKPOINT_PAGE - 1) / CHECKPOINT_PAGE;
+        sc_dt::uint64 index;
+        bool ok = fseek(file, 0, SEEK_END) == 0;
+        long end = ftell(file);
+        long position = records;
+        while (ok && position < end)
+        {
+            unsigned int length = 0;
+            ok = fseek(file, position, SEEK_SET) == 0
+                 && fread(&index, sizeof(index), 1, file) == 1
+                 && index < pages
+                 && (length = pageLength(index)) != 0
+                 && end - position >= long(sizeof(index) + length);
+            position += sizeof(index) + length;
+        }
+
+        if (ok)
+        {
+            clear();
+
+            unsigned char page[CHECKPOINT_PAGE];
+            ok = fseek(file, records, SEEK_SET) == 0;
+            while (ok && fread(&index, sizeof(index), 1, file) == 1)
+            {
+                unsigned int length = pageLength(index);
+                ok = fread(page, length, 1, file) == 1;
+                if (ok)
+                {
+                    write(index * CHECKPOINT_PAGE, page, length);
+                }
+            }
+        }
+        fclose(file);
+
+        if (!ok)
+        {
+            SC_REPORT_ERROR("backingStore",
+                            ("Corrupt checkpoint " + path).c_str());
+        }
+        return ok;
+    }
+
+    protected:
+
+    // First checkpoint page at or after index that may hold data. Sparse
+    // stores skip the pages they have never written.
+    virtual sc_dt::uint64 nextPage(sc_dt::uint64 index)
+    {
+        return index;
+    }
+
+    private:
+
+    struct checkpointHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t pageSize;
+        sc_dt::uint64 size;
+    };
+
+    unsigned int pageLength(sc_dt::uint64 index)
+    {
+        sc_dt::uint64 rest = size() - index * CHECKPOINT_PAGE;
+        return (rest < CHECKPOINT_PAGE) ? rest : CHECKPOINT_PAGE;
+    }
+};
+
+// Common part of the stores that keep all contents in one host array
+class contiguousStore : public backingStore
+{
+    protected:
+
+    unsigned char *mem;
+    sc_dt::uint64 bytes;
+
+    contiguousStore() : mem(0), bytes(0)
+    {
+    }
+
+    public:
+
+    sc_dt::uint64 size() const
+    {
+        return bytes;
+    }
+
+    void read(sc_dt::uint64 address, unsigned char *data, unsigned int length)
+    {
+        memcpy(data, &mem[address], length);
+    }
+
+    void write(sc_dt::uint64 address,
+               const unsigned char *data,
+               unsigned int length)
+    {
+        memcpy(&mem[address], data, length);
+    }
+
+    void readMasked(sc_dt::uint64 address,
+                    unsigned char *data,
+                    unsigned int length,
+                    const unsigned char *mask,
+                    unsigned int maskLength,
+                    unsigned int maskOffset)
+    {
+        maskedCopy(data, &mem[address], length, mask, maskLength, maskOffset);
+    }
+
+    void writeMasked(sc_dt::uint64 address,
+                     const unsigned char *data,
+                     unsigned int length,
+                     const unsigned char *mask,
+                     unsigned int maskLength,
+                     unsigned int maskOffset)
+    {
+        maskedCopy(&mem[address], data, length, mask, maskLength, maskOffset);
+    }
+
+    unsigned char *directPointer(sc_dt::uint64 address,
+                                 sc_dt::uint64 &start,
+                                 sc_dt::uint64 &end)
+    {
+        start = 0;
+        end = bytes - 1;
+        return mem;
+    }
+
+    void clear()
+    {
+        memset(mem, 0, bytes);
+    }
+};
+
+// One zero-initialized array on the heap
+class flatStore : public contiguousStore
+{
+    public:
+
+    flatStore(sc_dt::uint64 size)
+    {
+        // calloc lets the OS hand out zeroed pages lazily
+        mem = static_cast<unsigned char *>(calloc(size, 1));
+        if (mem == 0)
+        {
+            throw std::bad_alloc();
+        }
+        bytes = size;
+    }
+
+    ~flatStore()
+    {
+        free(mem);
+    }
+};
+
+// One zero-initialized array for large memories, aligned to and advised
+// for transparent huge pages, so that random accesses do not suffer from
+// host TLB misses. On Linux the array can be bound to a NUMA node, e.g.
+// the node of the CPU that runs the simulation. getHugePageBytes() tells
+// how much of the array is backed by huge pages once it has been touched.
+class hugePageStore : public contiguousStore
+{
+    public:
+
+    static const sc_dt::uint64 HUGE_PAGE_SIZE = sc_dt::uint64(2) << 20;
+
+    hugePageStore(sc_dt::uint64 size, int numaNode = -1)
+    {
+        bytes = size;
+        mapped = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+        // Over-allocate by one huge page and trim to an aligned range
+        unsigned char *base = static_cast<unsigned char *>(
+            mmap(0, mapped + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (base == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+
+        uintptr_t misalignment = reinterpret_cast<uintptr_t>(base)
+                               & (HUGE_PAGE_SIZE - 1);
+        sc_dt::uint64 head = misalignment ? HUGE_PAGE_SIZE - misalignment : 0;
+        if (head)
+        {
+            munmap(base, head);
+        }
+        munmap(base + head + mapped, HUGE_PAGE_SIZE - head);
+        mem = base + head;
+
+#ifdef MADV_HUGEPAGE
+        if (madvise(mem, mapped, MADV_HUGEPAGE) != 0)
+        {
+            SC_REPORT_WARNING("hugePageStore",
+                              "Transparent huge pages are not available");
+        }
+#endif
+
+        if (numaNode >= 0)
+        {
+            bindToNode(numaNode);
+        }
+    }
+
+    ~hugePageStore()
+    {
+        munmap(mem, mapped);
+    }
+
+    // Bytes of the array backed by huge pages, from /proc/self/smaps
+    sc_dt::uint64 getHugePageBytes() const
+    {
+        sc_dt::uint64 hugeBytes = 0;
+        FILE *smaps = fopen("/proc/self/smaps", "r");
+        if (smaps == 0)
+        {
+            return 0;
+        }
+
+        // The kernel may split the array into several mappings
+        uintptr_t begin = reinterpret_cast<uintptr_t>(mem);
+        uintptr_t end = begin + mapped;
+        bool inside = false;
+        char line[256];
+        while (fgets(line, sizeof(line), smaps))
+        {
+            unsigned long start, stop;
+            unsigned long long kiloBytes;
+            if (sscanf(line, "%lx-%lx ", &start, &stop) == 2)
+            {
+                inside = start < end && stop > begin;
+            }
+            else if (inside
+                     && sscanf(line, "AnonHugePages: %llu kB", &kiloBytes) == 1)
+            {
+                hugeBytes += kiloBytes * 1024;
+            }
+        }
+        fclose(smaps);
+        return hugeBytes;
+    }
+
+    private:
+
+    sc_dt::uint64 mapped;
+
+    void bindToNode(int numaNode)
+    {
+#if defined(__linux__) && defined(SYS_mbind)
+        // mbind without libnuma; the pages are not touched yet, so they are
+        // all allocated on the node
+        const int MPOL_BIND_POLICY = 2;
+        unsigned long nodeMask[16] = {0};
+        const unsigned long maskBits = 8 * sizeof(nodeMask);
+        if (static_cast<unsigned long>(numaNode) < maskBits)
+        {
+            nodeMask[numaNode / (8 * sizeof(unsigned long))] |=
+                1UL << (numaNode % (8 * sizeof(unsigned long)));
+            if (syscall(SYS_mbind, mem, mapped, MPOL_BIND_POLICY,
+                        nodeMask, maskBits, 0) == 0)
+            {
+                return;
+            }
+        }
+        SC_REPORT_WARNING("hugePageStore", "Cannot bind to the NUMA node");
+#else
+        SC_REPORT_WARNING("hugePageStore", "NUMA binding is not supported");
+#endif
+    }
+};
+
+// Sparse store for large address spaces: pages are allocated on the first
+// write, reads of untouched pages return zeros. The page table has two
+// levels, so that only the directory grows with the size of the store.
+// Tables and pages are reference counted and shared with snapshots. A
+// snapshot copies only the directory; a shared table is copied on the next
+// write into it and a shared page on its next write, so a snapshot costs
+// the tables and pages written afterwards.
+//
+// compact() drops pages that are all zeros, shares pages with equal
+// contents and, if enabled, compresses the pages that were not accessed
+// since the previous compact(). A compressed page is decoded on a first
+// read and inflated again on a second access or a write.
+class pagedStore : public backingStore
+{
+    public:
+
+    static const unsigned int PAGE_BITS = 12;
+    static const sc_dt::uint64 PAGE_SIZE = sc_dt::uint64(1) << PAGE_BITS;
+    static const unsigned int TABLE_BITS = 9;
+    static const sc_dt::uint64 TABLE_SIZE = sc_dt::uint64(1) << TABLE_BITS;
+
+    pagedStore(sc_dt::uint64 size, bool compressColdPages = false)
+        : bytes(size),
+        compressColdPages(compressColdPages),
+        residentPages(0),
+        lastIndex(~sc_dt::uint64(0)),
+        lastPage(0),
+        readOnlyGrants(false),
+        staleStart(~sc_dt::uint64(0)),
+        staleEnd(0)
+    {
+        sc_dt::uint64 pages = (size + PAGE_SIZE - 1) >> PAGE_BITS;
+        directory.resize((pages + TABLE_SIZE - 1) >> TABLE_BITS, 0);
+    }
+
+    ~pagedStore()
+    {
+        clear();
+        for (pageDirectory *snapshot : snapshots)
+        {
+            if (snapshot)
+            {
+                releaseDirectory(*snapshot);
+                delete snapshot;
+            }
+        }
+    }
+
+    sc_dt::uint64 size() const
+    {
+        return bytes;
+    }
+
+    // Number of addressed pages that are not implicitly zero; pages shared
+    // by several addresses are counted for each of them
+    sc_dt::uint64 getResidentPages() const
+    {
+        return residentPages;
+    }
+
+    void read(sc_dt::uint64 address, unsigned char *data, unsigned int length)
+    {
+        while (length > 0)
+        {
+            sc_dt::uint64 offset = address & (PAGE_SIZE - 1);
+            unsigned int chunk = chunkLength(offset, length);
+            page *p = findPage(address >> PAGE_BITS);
+
+            if (p)
+            {
+                memcpy(data, readablePage(p) + offset, chunk);
+            }
+            else
+            {
+                memset(data, 0, chunk);
+            }
+
+            address += chunk;
+            data += chunk;
+            length -= chunk;
+        }
+    }
+
+    void write(sc_dt::uint64 address,
+               const unsigned char *data,
+               unsigned int length)
+    {
+        while (length > 0)
+        {
+            sc_dt::uint64 offset = address & (PAGE_SIZE - 1);
+            unsigned int chunk = chunkLength(offset, length);
+            page *p = touchPage(address >> PAGE_BITS);
+
+            memcpy(p->data + offset, data, chunk);
+
+            address += chunk;
+            data += chunk;
+            length -= chunk;
+        }
+    }
+
+    // DMI is granted page by page, the page is allocated on demand
+    unsigned char *directPointer(sc_dt::uint64 address,
+                                 sc_dt::uint64 &start,
+                                 sc_dt::uint64 &end)
+    {
+        sc_assert(address < bytes);
+        pageRange(address, start, end);
+        return touchPage(address >> PAGE_BITS)->data;
+    }
+
+    // Reads do not allocate: absent pages are granted on shared zeros and
+    // shared pages read-only, until a write replaces them
+    unsigned char *readPointer(sc_dt::uint64 address,
+                               sc_dt::uint64 &start,
+                               sc_dt::uint64 &end,
+                               bool &writable)
+    {
+        sc_assert(address < bytes);
+        pageRange(address, start, end);
+        page *p = findPage(address >> PAGE_BITS);
+        if (p == 0)
+        {
+            static unsigned char zeros[PAGE_SIZE];
+            readOnlyGrants = true;
+            writable = false;
+            return zeros;
+        }
+
+        inflatePage(p);
+        p->accessed = true;
+        writable = p->references == 1
+                   && directory[address >> (PAGE_BITS + TABLE_BITS)]
+                          ->references == 1;
+        readOnlyGrants = readOnlyGrants || !writable;
+        return p->data;
+    }
+
+    bool staleReadPointers(sc_dt::uint64 &start, sc_dt::uint64 &end)
+    {
+        if (staleStart > staleEnd)
+        {
+            return false;
+        }
+
+        start = staleStart;
+        end = staleEnd;
+        staleStart = ~sc_dt::uint64(0);
+        staleEnd = 0;
+        return true;
+    }
+
+    void clear()
+    {
+        releaseDirectory(directory);
+        residentPages = 0;
+        lastIndex = ~sc_dt::uint64(0);
+        lastPage = 0;
+    }
+
+    // Pointers handed out by directPointer() must be invalidated before
+    // compacting, since pages are freed or shared.
+    sc_dt::uint64 compact()
+    {
+        std::unordered_multimap<uint64_t, page *> contents;
+        // Every page is examined once, also if several addresses map it:
+        // the page that replaces it, 0 if it was dropped
+        std::unordered_map<page *, page *> visited;
+        sc_dt::uint64 heldBytes = 0;
+
+        for (pageTable *table : directory)
+        {
+            if (table == 0)
+            {
+                continue;
+            }
+
+            for (sc_dt::uint64 i = 0; i < TABLE_SIZE; i++)
+            {
+                page *&p = table->pages[i];
+                if (p == 0)
+                {
+                    continue;
+                }
+
+                auto seen = visited.find(p);
+                if (seen != visited.end())
+                {
+                    if (seen->second != p)
+                    {
+                        replacePage(table, p, seen->second);
+                    }
+                    continue;
+                }
+
+                if (isZeroPage(p))
+                {
+                    visited[p] = 0;
+                    replacePage(table, p, 0);
+                    continue;
+                }
+
+                if (compressColdPages && !p->accessed)
+                {
+                    compressPage(p);
+                }
+                p->accessed = false;
+
+                // Share the first page with equal contents. The codec is
+                // deterministic, so equal compressed pages are equal.
+                uint64_t hash = hashPage(p);
+                auto range = contents.equal_range(hash);
+                page *equal = 0;
+                for (auto it = range.first; it != range.second && !equal; ++it)
+                {
+                    if (samePage(it->second, p))
+                    {
+                        equal = it->second;
+                    }
+                }
+
+                if (equal)
+                {
+                    visited[p] = equal;
+                    replacePage(table, p, equal);
+                }
+                else
+                {
+                    visited[p] = p;
+                    contents.insert(std::make_pair(hash, p));
+                    heldBytes += storedLength(p);
+                }
+            }
+        }
+
+        // Accesses have to set the accessed bits again
+        lastIndex = ~sc_dt::uint64(0);
+        lastPage = 0;
+        return heldBytes;
+    }
+
+    // Pointers handed out by directPointer() must be invalidated before a
+    // snapshot is taken or restored, since they bypass the copy on write.
+    unsigned int takeSnapshot()
+    {
+        unsigned int snapshot = 0;
+        while (snapshot < snapshots.size() && snapshots[snapshot])
+        {
+            snapshot++;
+        }
+        if (snapshot == snapshots.size())
+        {
+            snapshots.push_back(0);
+        }
+
+        snapshots[snapshot] = new pageDirectory(directory);
+        shareDirectory(directory);
+        return snapshot;
+    }
+
+    void restoreSnapshot(unsigned int snapshot)
+    {
+        if (!validSnapshot(snapshot))
+        {
+            return;
+        }
+
+        clear();
+        directory = *snapshots[snapshot];
+        shareDirectory(directory);
+        for (pageTable *table : directory)
+        {
+            residentPages += table ? table->used : 0;
+        }
+    }
+
+    void releaseSnapshot(unsigned int snapshot)
+    {
+        if (!validSnapshot(snapshot))
+        {
+            return;
+        }
+
+        releaseDirectory(*snapshots[snapshot]);
+        delete snapshots[snapshot];
+        snapshots[snapshot] = 0;
+    }
+
+    protected:
+
+    // Only resident pages are written to checkpoints
+    sc_dt::uint64 nextPage(sc_dt::uint64 index)
+    {
+        static_assert(PAGE_SIZE == CHECKPOINT_PAGE,
+                      "Checkpoint pages must match the pages of the store");
+
+        sc_dt::uint64 pages = (bytes + PAGE_SIZE - 1) >> PAGE_BITS;
+        for (; index < pages; index++)
+        {
+            if (directory[index >> TABLE_BITS] == 0)
+            {
+                // Skip the whole table
+                index |= TABLE_SIZE - 1;
+            }
+            else if (findPage(index))
+            {
+                return index;
+            }
+        }
+        return index;
+    }
+
+    private:
+
+    struct page
+    {
+        unsigned int references;
+        bool accessed;
+        unsigned int compressedLength; // 0 if data holds the plain page
+        unsigned char *data;
+    };
+
+    struct pageTable
+    {
+        unsigned int references; // directories that share the table
+        unsigned int used;       // pages that are not implicitly zero
+        page *pages[TABLE_SIZE];
+    };
+
+    typedef std::vector<pageTable *> pageDirectory;
+
+    sc_dt::uint64 bytes;
+    bool compressColdPages;
+    sc_dt::uint64 residentPages;
+    pageDirectory directory;
+    std::vector<pageDirectory *> snapshots;
+
+    // Last page found, consecutive accesses mostly hit the same page
+    sc_dt::uint64 lastIndex;
+    page *lastPage;
+
+    // Compressed pages that are read once are decoded into this buffer
+    unsigned char decoded[PAGE_SIZE];
+
+    // Set once readPointer() handed out a block that a write would replace;
+    // the range of such writes since the last staleReadPointers()
+    bool readOnlyGrants;
+    sc_dt::uint64 staleStart;
+    sc_dt::uint64 staleEnd;
+
+    void pageRange(sc_dt::uint64 address,
+                   sc_dt::uint64 &start,
+                   sc_dt::uint64 &end) const
+    {
+        start = address & ~(PAGE_SIZE - 1);
+        end = start + PAGE_SIZE - 1;
+        if (end >= bytes)
+        {
+            end = bytes - 1;
+        }
+    }
+
+    static unsigned int chunkLength(sc_dt::uint64 offset, unsigned int length)
+    {
+        sc_dt::uint64 rest = PAGE_SIZE - offset;
+        return (length < rest) ? length : static_cast<unsigned int>(rest);
+    }
+
+    page *findPage(sc_dt::uint64 index)
+    {
+        sc_assert(index < (bytes + PAGE_SIZE - 1) >> PAGE_BITS);
+        if (index == lastIndex)
+        {
+            return lastPage;
+        }
+
+        pageTable *table = directory[index >> TABLE_BITS];
+        if (table == 0 || table->pages[index & (TABLE_SIZE - 1)] == 0)
+        {
+            return 0;
+        }
+
+        lastIndex = index;
+        lastPage = table->pages[index & (TABLE_SIZE - 1)];
+        return lastPage;
+    }
+
+    const unsigned char *readablePage(page *p)
+    {
+        if (p->compressedLength != 0 && !p->accessed)
+        {
+            // Cold page: decode without inflating it, e.g. for checkpoints
+            p->accessed = true;
+            decompressWords(p->data, p->compressedLength, decoded);
+            return decoded;
+        }
+
+        inflatePage(p);
+        p->accessed = true;
+        return p->data;
+    }
+
+    // Returns the page for writing: allocates it, or copies it if it is
+    // shared with a snapshot or another page of equal contents. A table
+    // shared with a snapshot is copied first.
+    page *touchPage(sc_dt::uint64 index)
+    {
+        sc_assert(index < (bytes + PAGE_SIZE - 1) >> PAGE_BITS);
+        pageTable *&table = directory[index >> TABLE_BITS];
+        if (table == 0)
+        {
+            table = new pageTable();
+            table->references = 1;
+        }
+        else if (table->references > 1)
+        {
+            table = copyTable(table);
+        }
+
+        page *&slot = table->pages[index & (TABLE_SIZE - 1)];
+        page *p = slot;
+        lastIndex = index;
+        if (p && p->references == 1)
+        {
+            inflatePage(p);
+            p->accessed = true;
+            lastPage = p;
+            return p;
+        }
+
+        if (readOnlyGrants)
+        {
+            // The zeros or the shared page may be mapped read-only
+            sc_dt::uint64 start = index << PAGE_BITS;
+            staleStart = std::min(staleStart, start);
+            staleEnd = std::max(staleEnd, start + PAGE_SIZE - 1);
+        }
+
+        page *copy = new page;
+        copy->references = 1;
+        copy->accessed = true;
+        copy->compressedLength = 0;
+        if (p)
+        {
+            copy->data = new unsigned char[PAGE_SIZE];
+            if (p->compressedLength != 0)
+            {
+                decompressWords(p->data, p->compressedLength, copy->data);
+            }
+            else
+            {
+                memcpy(copy->data, p->data, PAGE_SIZE);
+            }
+            p->references--;
+        }
+        else
+        {
+            copy->data = new unsigned char[PAGE_SIZE](); // zeroed
+            residentPages++;
+            table->used++;
+        }
+        slot = copy;
+
+        lastPage = copy;
+        return copy;
+    }
+
+    // Tests compressed pages too, without counting that as an access
+    bool isZeroPage(const page *p)
+    {
+        if (p->compressedLength == 0)
+        {
+            return isZero(p->data, PAGE_SIZE);
+        }
+        decompressWords(p->data, p->compressedLength, decoded);
+        return isZero(decoded, PAGE_SIZE);
+    }
+
+    // Replaces the page of a slot during compact(), 0 drops it
+    void replacePage(pageTable *table, page *&slot, page *replacement)
+    {
+        releasePage(slot);
+        slot = replacement;
+        if (replacement)
+        {
+            replacement->references++;
+        }
+        else
+        {
+            residentPages--;
+            table->used--;
+        }
+    }
+
+    // Private copy of a shared table, its pages get one more reference
+    static pageTable *copyTable(pageTable *shared)
+    {
+        pageTable *table = new pageTable(*shared);
+        table->references = 1;
+        shared->references--;
+        for (sc_dt::uint64 i = 0; i < TABLE_SIZE; i++)
+        {
+            if (table->pages[i])
+            {
+                table->pages[i]->references++;
+            }
+        }
+        return table;
+    }
+
+    static void inflatePage(page *p)
+    {
+        if (p->compressedLength != 0)
+        {
+            unsigned char *data = new unsigned char[PAGE_SIZE];
+            decompressWords(p->data, p->compressedLength, data);
+            delete[] p->data;
+            p->data = data;
+            p->compressedLength = 0;
+        }
+    }
+
+    // Pages are only kept compressed if that saves at least half of them
+    static void compressPage(page *p)
+    {
+        if (p->compressedLength != 0)
+        {
+            return;
+        }
+
+        unsigned char buffer[PAGE_SIZE / 2];
+        unsigned int length = compressWords(p->data, PAGE_SIZE / 8,
+                                            buffer, sizeof(buffer));
+        if (length != 0)
+        {
+            delete[] p->data;
+            p->data = new unsigned char[length];
+            memcpy(p->data, buffer, length);
+            p->compressedLength = length;
+        }
+    }
+
+    static unsigned int storedLength(const page *p)
+    {
+        return p->compressedLength ? p->compressedLength : PAGE_SIZE;
+    }
+
+    // FNV-1a over the stored representation
+    static uint64_t hashPage(const page *p)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned int i = 0; i < storedLength(p); i++)
+        {
+            hash = (hash ^ p->data[i]) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static bool samePage(const page *a, const page *b)
+    {
+        return a->compressedLength == b->compressedLength
+            && memcmp(a->data, b->data, storedLength(a)) == 0;
+    }
+
+    static void releasePage(page *p)
+    {
+        if (--p->references == 0)
+        {
+            delete[] p->data;
+            delete p;
+        }
+    }
+
+    // Adds a directory that shares the tables
+    static void shareDirectory(pageDirectory &tables)
+    {
+        for (pageTable *table : tables)
+        {
+            if (table)
+            {
+                table->references++;
+            }
+        }
+    }
+
+    static void releaseDirectory(pageDirectory &tables)
+    {
+        for (pageTable *&table : tables)
+        {
+            if (table == 0)
+            {
+                continue;
+            }
+
+            if (--table->references == 0)
+            {
+                for (sc_dt::uint64 i = 0; i < TABLE_SIZE; i++)
+                {
+                    if (table->pages[i])
+                    {
+                        releasePage(table->pages[i]);
+                    }
+                }
+                delete table;
+            }
+            table = 0;
+        }
+    }
+
+    bool validSnapshot(unsigned int snapshot)
+    {
+        if (snapshot >= snapshots.size() || snapshots[snapshot] == 0)
+        {
+            SC_REPORT_ERROR("pagedStore", "Unknown snapshot");
+            return false;
+        }
+        return true;
+    }
+};
+
+// Host file mapped into memory, so that large images are available at time
+// zero without copying. A PRIVATE mapping is copy-on-write: the file stays
+// untouched, unless a persist path is given, to which the modified image is
+// written at the end of simulation. A SHARED mapping writes through to the
+// file. SystemC only ends the simulation explicitly after sc_stop(), so
+// the store is also flushed when it is destroyed, unless that happened
+// already. A size larger than the file is filled up with zeros; a SHARED
+// mapping grows the file accordingly. Size 0 takes the size of the file.
+class mappedStore : public contiguousStore
+{
+    public:
+
+    enum mapping { PRIVATE, SHARED };
+
+    mappedStore(const std::string &path,
+                sc_dt::uint64 size = 0,
+                mapping mode = PRIVATE,
+                const std::string &persistPath = "")
+        : mode(mode),
+        persistPath(persistPath),
+        flushed(false)
+    {
+        int fd = open(path.c_str(), (mode == SHARED) ? O_RDWR : O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0)
+        {
+            SC_REPORT_FATAL("mappedStore", ("Cannot open " + path).c_str());
+        }
+
+        sc_dt::uint64 fileSize = info.st_size;
+        bytes = (size != 0) ? size : fileSize;
+
+        if (mode == SHARED && fileSize < bytes)
+        {
+            if (ftruncate(fd, bytes) != 0)
+            {
+                SC_REPORT_FATAL("mappedStore", ("Cannot grow " + path).c_str());
+            }
+            fileSize = bytes;
+        }
+
+        // Reserve the whole range with zero pages, then map the file over
+        // its beginning:
+        void *base = mmap(0, bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            SC_REPORT_FATAL("mappedStore", "Cannot reserve address space");
+        }
+
+        sc_dt::uint64 mapped = (fileSize < bytes) ? fileSize : bytes;
+        if (mapped > 0
+            && mmap(base, mapped, PROT_READ | PROT_WRITE,
+                    ((mode == SHARED) ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED,
+                    fd, 0) == MAP_FAILED)
+        {
+            SC_REPORT_FATAL("mappedStore", ("Cannot map " + path).c_str());
+        }
+
+        close(fd);
+        mem = static_cast<unsigned char *>(base);
+    }
+
+    ~mappedStore()
+    {
+        if (!flushed)
+        {
+            // An error is displayed before it is thrown; a destructor
+            // must not throw
+            try
+            {
+                flush();
+            }
+            catch (const sc_core::sc_report &)
+            {
+            }
+        }
+        munmap(mem, bytes);
+    }
+
+    void flush()
+    {
+        flushed = true;
+        if (mode == SHARED)
+        {
+            msync(mem, bytes, MS_SYNC);
+        }
+        else if (!persistPath.empty())
+        {
+            persist(persistPath);
+        }
+    }
+
+    // Write the current image to a file. The file is not truncated before,
+    // so that it may be the file behind a PRIVATE mapping.
+    void persist(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+        {
+            SC_REPORT_ERROR("mappedStore", ("Cannot open " + path).c_str());
+            return;
+        }
+
+        sc_dt::uint64 done = 0;
+        while (done < bytes)
+        {
+            ssize_t written = pwrite(fd, mem + done, bytes - done, done);
+            if (written <= 0)
+            {
+                SC_REPORT_ERROR("mappedStore",
+                                ("Cannot write " + path).c_str());
+                break;
+            }
+            done += written;
+        }
+
+        if (done == bytes && ftruncate(fd, bytes) != 0)
+        {
+            SC_REPORT_ERROR("mappedStore", ("Cannot resize " + path).c_str());
+        }
+        close(fd);
+    }
+
+    private:
+
+    mapping mode;
+    std::string persistPath;
+    bool flushed; // by end_of_simulation() of the memory
+};
+
+#endif
@@ -33,8 +33,10 @@
 
 #include <iostream>
 #include <iomanip>
+#include <deque>
 #include <map>
 #include <queue>
+#include <vector>
 
 #include <systemc.h>
 #include <tlm.h>
@@ -42,106 +44,261 @@
 // Convenience Sockets:
 #include <tlm_utils/multi_passthrough_initiator_socket.h>
 #include <tlm_utils/multi_passthrough_target_socket.h>
+#include <tlm_utils/peq_with_cb_and_phase.h>
+
+#include "address_map.h"
 
 using namespace std;
 
+// Routing state of the interconnects on the path of a transaction. Every
+// interconnect pushes a frame on BEGIN_REQ and pops it again when it is done
+// with the transaction, so chained interconnects nest like calls and each of
+// them finds its own ports and the address it received.
 class routingExtension : public tlm::tlm_extension<routingExtension>
 {
+public:
+    struct frame
+    {
+        const void *owner; // the interconnect
+        int inputPortNumber;
+        int outputPortNumber;
+        sc_dt::uint64 address; // address received, before the translation
+    };
+
 private:
-    int inputPortNumber;
-    int outputPortNumber;
+    std::vector<frame> frames;
 
 public:
-    routingExtension(int i, int o) : inputPortNumber(i),
-                                     outputPortNumber(o)
+    tlm_extension_base *clone() const
     {
-        cout << "\033[1;36m(E"
-             << ") @"  << setfill(' ') << setw(12) << sc_time_stamp()
-             << ": Extension Created = "
-             << "  inPort = " << dec << setfill(' ') << setw(2) << i
-             << " outPort = " << dec << setfill(' ') << setw(2) << o
-             << "\033[0m" << endl;
+        return new routingExtension(*this);
     }
 
-    tlm_extension_base *clone() const
+    void copy_from(const tlm_extension_base &ext)
     {
-        return new routingExtension(inputPortNumber, outputPortNumber);
+        frames = static_cast<const routingExtension &>(ext).frames;
     }
 
-    void copy_from(const tlm_extension_base &ext)
+    void push(const void *owner, int i, int o, sc_dt::uint64 a)
+    {
+        frame f = {owner, i, o, a};
+        frames.push_back(f);
+    }
+
+    // The innermost frame of owner, 0 if owner does not route the
+    // transaction
+    const frame *find(const void *owner) const
     {
-        const routingExtension &cpyFrom =
-                static_cast<const routingExtension &>(ext);
-        inputPortNumber = cpyFrom.getInputPortNumber();
-        outputPortNumber = cpyFrom.getOutputPortNumber();
+        for (size_t k = frames.size(); k > 0; k--)
+        {
+            if (frames[k - 1].owner == owner)
+            {
+                return &frames[k - 1];
+            }
+        }
+        return 0;
     }
 
-    int getInputPortNumber() const
+    void pop(const void *owner)
     {
-        return inputPortNumber;
+        for (size_t k = frames.size(); k > 0; k--)
+        {
+            if (frames[k - 1].owner == owner)
+            {
+                frames.erase(frames.begin() + (k - 1));
+                return;
+            }
+        }
     }
 
-    int getOutputPortNumber() const
+    // Number of interconnects the transaction currently passes
+    size_t getDepth() const
     {
-        return outputPortNumber;
+        return frames.size();
     }
 };
 
 
+// Handling of the AT protocol in the interconnect
+enum arbitrationPolicy
+{
+    PASS_THROUGH,   // forward every phase immediately, no arbitration
+    ROUND_ROBIN,    // rotate the grant of a target among the initiators
+    FIXED_PRIORITY, // grant the waiting initiator with the highest weight
+    WEIGHTED        // round robin, up to weight grants in a row
+};
+
 SC_MODULE(interconnect)
 {
 public:
     tlm_utils::multi_passthrough_target_socket<interconnect> tSocket;
     tlm_utils::multi_passthrough_initiator_socket<interconnect> iSocket;
 
-    SC_CTOR(interconnect) : tSocket("tSocket"), iSocket("iSocket")
+    SC_HAS_PROCESS(interconnect);
+
+    // With an arbitration policy the interconnect terminates the AT protocol
+    // on both sides: requests wait per target until they are granted, END_REQ
+    // is only sent to the initiator once the target accepted the request, and
+    // responses are queued per initiator. END_RESP is only sent to the target
+    // while the queue holds fewer than responseQueueDepth responses, so a
+    // slow initiator puts back-pressure on the targets.
+    interconnect(sc_module_name name,
+                 arbitrationPolicy policy = PASS_THROUGH,
+                 unsigned int responseQueueDepth = 4) :
+        sc_module(name),
+        tSocket("tSocket"),
+        iSocket("iSocket"),
+        policy(policy),
+        responseQueueDepth(responseQueueDepth),
+        tracing(true),
+        peq(this, &interconnect::peqCallback)
     {
+        if (responseQueueDepth == 0)
+        {
+            SC_REPORT_FATAL(this->name(),
+                    "Response queue depth must not be zero");
+        }
+
         tSocket.register_b_transport(this, &interconnect::b_transport);
         tSocket.register_nb_transport_fw(this, &interconnect::nb_transport_fw);
         iSocket.register_nb_transport_bw(this, &interconnect::nb_transport_bw);
+        tSocket.register_get_direct_mem_ptr(this,
+                &interconnect::get_direct_mem_ptr);
+        tSocket.register_transport_dbg(this, &interconnect::transport_dbg);
+        iSocket.register_invalidate_direct_mem_ptr(this,
+                &interconnect::invalidate_direct_mem_ptr);
+
+        SC_METHOD(arbitrationProcess);
+        sensitive << arbitrationEvent;
+        dont_initialize();
     }
 
-private:
-    int routeFW(int inPort,
-                tlm::tlm_generic_payload &trans,
-                bool store)
+    // Prints a line per routed request, e.g. off for large topologies
+    void setTracing(bool enable)
     {
-        int outPort = 0;
+        tracing = enable;
+    }
 
-        // Memory map implementation:
-        if (trans.get_address() < 512)
+    // Weight of an initiator port: the priority for FIXED_PRIORITY and the
+    // number of consecutive grants for WEIGHTED. The default weight is 1.
+    void setWeight(unsigned int initiator, unsigned int weight)
+    {
+        if (weight == 0)
         {
-            outPort = 0;
+            SC_REPORT_FATAL(name(), "Arbitration weight must not be zero");
         }
-        else if (trans.get_address() >= 512 && trans.get_address() < 1024)
+        if (weights.size() <= initiator)
         {
-            // Correct Address:
-            trans.set_address(trans.get_address() - 512);
-            outPort = 1;
+            weights.resize(initiator + 1, 1);
         }
-        else
+        weights[initiator] = weight;
+    }
+
+    // Routes size bytes of the global address space starting at base to an
+    // output port, where they appear starting at offset. The memory map is
+    // validated at the end of elaboration.
+    void addRegion(sc_dt::uint64 base,
+                   sc_dt::uint64 size,
+                   int port,
+                   sc_dt::uint64 offset = 0)
+    {
+        memoryMap.addRegion(base, size, port, offset);
+    }
+
+private:
+    addressMap memoryMap;
+
+    arbitrationPolicy policy;
+    unsigned int responseQueueDepth;
+    bool tracing;
+    tlm_utils::peq_with_cb_and_phase<interconnect> peq;
+    sc_event arbitrationEvent;
+    std::vector<unsigned int> weights;
+
+    // Per target: the request waiting from each initiator (at most one, due
+    // to the BEGIN_REQ/END_REQ exclusion rule), the request granted but not
+    // yet accepted, the last granted initiator and the remaining credits
+    std::vector<std::vector<tlm::tlm_generic_payload*> > pendingRequests;
+    std::vector<tlm::tlm_generic_payload*> requestInProgress;
+    std::vector<unsigned int> lastGrant;
+    std::vector<std::vector<unsigned int> > credits;
+
+    // Per target: the response that waits for END_RESP (at most one, due to
+    // the BEGIN_RESP/END_RESP exclusion rule)
+    std::vector<tlm::tlm_generic_payload*> targetResponse;
+
+    // Per initiator: responses waiting for BEGIN_RESP and the response
+    // that was sent but not yet ended. Beyond responseQueueDepth a queue
+    // only holds responses whose targets still wait for END_RESP, and
+    // responses completed by the target [3.0], which are bounded by the
+    // requests the initiator has outstanding.
+    std::vector<std::deque<tlm::tlm_generic_payload*> > responseQueues;
+    std::vector<tlm::tlm_generic_payload*> responseInProgress;
+
+    void end_of_elaboration()
+    {
+        memoryMap.validate(name(), iSocket.size());
+
+        unsigned int initiators = tSocket.size();
+        unsigned int targets = iSocket.size();
+        weights.resize(initiators, 1);
+
+        pendingRequests.assign(targets,
+                std::vector<tlm::tlm_generic_payload*>(initiators, 0));
+        requestInProgress.assign(targets, 0);
+        lastGrant.assign(targets, initiators - 1);
+        credits.assign(targets, weights);
+        targetResponse.assign(targets, 0);
+        responseQueues.assign(initiators,
+                std::deque<tlm::tlm_generic_payload*>());
+        responseInProgress.assign(initiators, 0);
+    }
+
+    // Decodes the address and translates it into the address space of the
+    // target. Returns 0 and sets an address error for holes in the map.
+    const addressMap::region *routeFW(int inPort,
+                                      tlm::tlm_generic_payload &trans,
+                                      bool store)
+    {
+        sc_dt::uint64 address = trans.get_address();
+        const addressMap::region *region = memoryMap.decode(address);
+
+        if (region == 0)
         {
             trans.set_response_status( tlm::TLM_ADDRESS_ERROR_RESPONSE );
+            return 0;
         }
 
+        trans.set_address(region->toLocal(address));
+
         if (store)
         {
-            routingExtension *ext = new routingExtension(inPort, outPort);
-            trans.set_auto_extension(ext);
+            // The extension is sticky: it is created the first time a pooled
+            // payload passes an interconnect and survives the reset() in the
+            // memory manager, so its frames are not reallocated afterwards.
+            routingExtension *ext = nullptr;
+            trans.get_extension(ext);
+            if (ext == nullptr)
+            {
+                ext = new routingExtension;
+                trans.set_extension(ext);
+            }
+            ext->push(this, inPort, region->port, address);
         }
 
-        return outPort;
+        return region;
     }
 
     virtual void b_transport(int id,
                              tlm::tlm_generic_payload &trans,
                              sc_time &delay)
     {
-        int outPort = routeFW(id, trans, false);
-        iSocket[outPort]->b_transport(trans, delay);
-        if(outPort == 1)
+        sc_dt::uint64 address = trans.get_address();
+        const addressMap::region *region = routeFW(id, trans, false);
+        if (region)
         {
-            trans.set_address(trans.get_address() + 512);
+            iSocket[region->port]->b_transport(trans, delay);
+            trans.set_address(address);
         }
     }
 
@@ -151,6 +308,11 @@ private:
                                                tlm::tlm_phase &phase,
                                                sc_time &delay)
     {
+        if (policy != PASS_THROUGH)
+        {
+            return arbitratedTransportFW(id, trans, phase, delay);
+        }
+
         int outPort = 0;
 
         if (phase == tlm::BEGIN_REQ)
@@ -162,38 +324,54 @@ private:
             // set by the interconnect component lying furthest downstream, and
             // so should be regarded as being undefined for the purposes of
             // transaction routing.
-            trans.acquire();
 
             // Modify address accoring to memory map:
-            outPort = routeFW(id, trans, true);
+            const addressMap::region *region = routeFW(id, trans, true);
+            if (region == 0)
+            {
+                // Hole in the memory map: complete with the address error
+                return tlm::TLM_COMPLETED;
+            }
+
+            trans.acquire();
+            outPort = region->port;
         }
         else if (phase == tlm::END_RESP)
         {
             // Adress was already modified in BEGIN_REQ phase:
-            routingExtension *ext = nullptr;
-            trans.get_extension(ext);
-            outPort = ext->getOutputPortNumber();
-            trans.release();
+            outPort = getRoute(trans).outputPortNumber;
         }
         else
         {
             SC_REPORT_FATAL(name(),"Illegal phase received by initiator");
         }
 
-        cout << "\033[1;37m("
-             << name()
-             << ")@"  << setfill(' ') << setw(12) << sc_time_stamp()
-             << ": Addr = " << setfill('0') << setw(8)
-             << dec << trans.get_address()
-             << "  inPort = " << dec << setfill(' ') << setw(2) << id
-             << " outPort = " << dec << setfill(' ') << setw(2) << outPort
-             << " ptr = " << &trans
-             << "\033[0m" << endl;
+        if (tracing)
+        {
+            cout << "\033[1;37m("
+                 << name()
+                 << ")@"  << setfill(' ') << setw(12) << sc_time_stamp()
+                 << ": Addr = " << setfill('0') << setw(8)
+                 << dec << trans.get_address()
+                 << "  inPort = " << dec << setfill(' ') << setw(2) << id
+                 << " outPort = " << dec << setfill(' ') << setw(2) << outPort
+                 << " ptr = " << &trans
+                 << "\033[0m" << endl;
+        }
                 
+        bool endResponse = (phase == tlm::END_RESP);
         tlm::tlm_sync_enum r = iSocket[outPort]->nb_transport_fw(trans, phase, delay);
-        if(outPort == 1 && phase == tlm::END_RESP)
+
+        // The target responded on the return path [3.0, 4.0]
+        if (r == tlm::TLM_COMPLETED
+            || (r == tlm::TLM_UPDATED && phase == tlm::BEGIN_RESP))
+        {
+            restoreAddress(trans);
+        }
+
+        if (endResponse || r == tlm::TLM_COMPLETED)
         {
-            trans.set_address(trans.get_address() + 512);
+            completeTransaction(trans);
         }
         return r;
     }
@@ -203,11 +381,463 @@ private:
                                                tlm::tlm_generic_payload &trans,
                                                tlm::tlm_phase &phase,
                                                sc_time &delay)
+    {
+        if (policy != PASS_THROUGH)
+        {
+            return arbitratedTransportBW(id, trans, phase, delay);
+        }
+
+        int inPort = getRoute(trans).inputPortNumber;
+
+        // The target is done with the address once it responds, the
+        // initiator may already use it when it handles the response
+        if (phase == tlm::BEGIN_RESP)
+        {
+            restoreAddress(trans);
+        }
+
+        tlm::tlm_sync_enum r = tSocket[inPort]->nb_transport_bw(trans, phase, delay);
+
+        // The initiator completed on the return path [2.1, 3.1]
+        if (r == tlm::TLM_COMPLETED
+            || (r == tlm::TLM_UPDATED && phase == tlm::END_RESP))
+        {
+            completeTransaction(trans);
+        }
+        return r;
+    }
+
+    tlm::tlm_sync_enum arbitratedTransportFW(int id,
+                                             tlm::tlm_generic_payload &trans,
+                                             tlm::tlm_phase &phase,
+                                             sc_time &delay)
+    {
+        if (phase == tlm::BEGIN_REQ)
+        {
+            if (routeFW(id, trans, true) == 0)
+            {
+                // Hole in the memory map: complete with the address error
+                return tlm::TLM_COMPLETED;
+            }
+            trans.acquire();
+        }
+        else if (phase != tlm::END_RESP)
+        {
+            SC_REPORT_FATAL(name(),"Illegal phase received by initiator");
+        }
+
+        peq.notify(trans, phase, delay);
+        return tlm::TLM_ACCEPTED;
+    }
+
+    tlm::tlm_sync_enum arbitratedTransportBW(int id,
+                                             tlm::tlm_generic_payload &trans,
+                                             tlm::tlm_phase &phase,
+                                             sc_time &delay)
+    {
+        if (phase != tlm::END_REQ && phase != tlm::BEGIN_RESP)
+        {
+            SC_REPORT_FATAL(name(),"Illegal phase received by target");
+        }
+
+        // The target waits for END_RESP until the response is queued
+        if (phase == tlm::BEGIN_RESP)
+        {
+            targetResponse[id] = &trans;
+        }
+
+        peq.notify(trans, phase, delay);
+        return tlm::TLM_ACCEPTED;
+    }
+
+    // The phases of both sides are disjoint: BEGIN_REQ and END_RESP come
+    // from initiators, END_REQ and BEGIN_RESP from targets
+    void peqCallback(tlm::tlm_generic_payload &trans,
+                     const tlm::tlm_phase &phase)
+    {
+        const routingExtension::frame &route = getRoute(trans);
+        int inPort = route.inputPortNumber;
+        int outPort = route.outputPortNumber;
+
+        if (phase == tlm::BEGIN_REQ)
+        {
+            if (pendingRequests[outPort][inPort] != 0)
+            {
+                SC_REPORT_FATAL(name(),
+                        "BEGIN_REQ before END_REQ of the previous request");
+            }
+            pendingRequests[outPort][inPort] = &trans;
+            // Arbitrate once all requests of this delta cycle arrived
+            arbitrationEvent.notify(SC_ZERO_TIME);
+        }
+        else if (phase == tlm::END_REQ || phase == tlm::BEGIN_RESP)
+        {
+            if (requestInProgress[outPort] == &trans)
+            {
+                requestInProgress[outPort] = 0;
+                arbitrationEvent.notify(SC_ZERO_TIME);
+
+                // The request is accepted downstream, so the initiator may
+                // send its next one. A BEGIN_RESP also ends the request phase
+                // of the initiator [4.0].
+                if (phase == tlm::END_REQ)
+                {
+                    tlm::tlm_phase endRequest = tlm::END_REQ;
+                    sc_time delay = SC_ZERO_TIME;
+                    tSocket[inPort]->nb_transport_bw(trans, endRequest, delay);
+                }
+            }
+
+            if (phase == tlm::BEGIN_RESP)
+            {
+                responseQueues[inPort].push_back(&trans);
+                if (responseQueues[inPort].size() <= responseQueueDepth)
+                {
+                    endTargetResponse(trans);
+                }
+                sendResponses(inPort);
+            }
+        }
+        else if (phase == tlm::END_RESP)
+        {
+            if (responseInProgress[inPort] != &trans)
+            {
+                SC_REPORT_FATAL(name(), "END_RESP for an unknown response");
+            }
+            responseInProgress[inPort] = 0;
+            completeTransaction(trans);
+            sendResponses(inPort);
+        }
+    }
+
+    void arbitrationProcess()
+    {
+        for (unsigned int target = 0; target < iSocket.size(); target++)
+        {
+            arbitrate(target);
+        }
+    }
+
+    void arbitrate(unsigned int target)
+    {
+        if (requestInProgress[target] != 0)
+        {
+            // Wait for END_REQ of the target
+            return;
+        }
+
+        int inPort = selectInitiator(target);
+        if (inPort < 0)
+        {
+            return;
+        }
+
+        tlm::tlm_generic_payload *trans = pendingRequests[target][inPort];
+        pendingRequests[target][inPort] = 0;
+        requestInProgress[target] = trans;
+
+        if (tracing)
+        {
+            cout << "\033[1;37m("
+                 << name()
+                 << ")@"  << setfill(' ') << setw(12) << sc_time_stamp()
+                 << ": Addr = " << setfill('0') << setw(8)
+                 << dec << trans->get_address()
+                 << "  inPort = " << dec << setfill(' ') << setw(2) << inPort
+                 << " outPort = " << dec << setfill(' ') << setw(2) << target
+                 << " ptr = " << trans
+                 << "\033[0m" << endl;
+        }
+
+        tlm::tlm_phase phase = tlm::BEGIN_REQ;
+        sc_time delay = SC_ZERO_TIME;
+        tlm::tlm_sync_enum r = iSocket[target]->nb_transport_fw(*trans,
+                                                                phase,
+                                                                delay);
+        if (r == tlm::TLM_UPDATED)
+        {
+            // END_REQ [2.0] or BEGIN_RESP [4.0] on the return path. After a
+            // BEGIN_RESP the target waits for END_RESP like on the backward
+            // path.
+            if (phase == tlm::BEGIN_RESP)
+            {
+                targetResponse[target] = trans;
+            }
+            peq.notify(*trans, phase, delay);
+        }
+        else if (r == tlm::TLM_COMPLETED)
+        {
+            // The target executed the request right away [3.0]
+            tlm::tlm_phase response = tlm::BEGIN_RESP;
+            peq.notify(*trans, response, delay);
+        }
+    }
+
+    // Returns the initiator port that gets the target, or -1 if no request
+    // is waiting
+    int selectInitiator(unsigned int target)
+    {
+        std::vector<tlm::tlm_generic_payload*> &requests =
+                pendingRequests[target];
+        unsigned int n = requests.size();
+
+        if (policy == FIXED_PRIORITY)
+        {
+            int winner = -1;
+            for (unsigned int i = 0; i < n; i++)
+            {
+                if (requests[i] != 0
+                    && (winner < 0 || weights[i] > weights[winner]))
+                {
+                    winner = i;
+                }
+            }
+            return winner;
+        }
+
+        if (policy == WEIGHTED)
+        {
+            // The last granted initiator keeps the target while it has
+            // credits left. When all waiting initiators used their credits
+            // a new round starts.
+            for (int round = 0; round < 2; round++)
+            {
+                for (unsigned int k = 0; k < n; k++)
+                {
+                    unsigned int i = (lastGrant[target] + k) % n;
+                    if (requests[i] != 0 && credits[target][i] > 0)
+                    {
+                        credits[target][i]--;
+                        lastGrant[target] = i;
+                        return i;
+                    }
+                }
+                credits[target] = weights;
+            }
+            return -1;
+        }
+
+        // Round robin: start after the last granted initiator
+        for (unsigned int k = 1; k <= n; k++)
+        {
+            unsigned int i = (lastGrant[target] + k) % n;
+            if (requests[i] != 0)
+            {
+                lastGrant[target] = i;
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Sends the queued responses of an initiator, one at a time according
+    // to the BEGIN_RESP/END_RESP exclusion rule
+    void sendResponses(int inPort)
+    {
+        while (responseInProgress[inPort] == 0
+               && !responseQueues[inPort].empty())
+        {
+            tlm::tlm_generic_payload *trans = responseQueues[inPort].front();
+            responseQueues[inPort].pop_front();
+            responseInProgress[inPort] = trans;
+
+            // The queue has room for the next waiting response
+            if (responseQueues[inPort].size() >= responseQueueDepth)
+            {
+                endTargetResponse(
+                        *responseQueues[inPort][responseQueueDepth - 1]);
+            }
+
+            restoreAddress(*trans);
+
+            tlm::tlm_phase phase = tlm::BEGIN_RESP;
+            sc_time delay = SC_ZERO_TIME;
+            tlm::tlm_sync_enum r = tSocket[inPort]->nb_transport_bw(*trans,
+                                                                    phase,
+                                                                    delay);
+            if (r == tlm::TLM_UPDATED)
+            {
+                // END_RESP on the return path [2.1]
+                peq.notify(*trans, phase, delay);
+            }
+            else if (r == tlm::TLM_COMPLETED)
+            {
+                // [3.1]
+                responseInProgress[inPort] = 0;
+                completeTransaction(*trans);
+            }
+        }
+    }
+
+    // Sends END_RESP to the target of a queued response, which may then
+    // send its next one. Responses the target completed itself [3.0] are
+    // not waited for.
+    void endTargetResponse(tlm::tlm_generic_payload &trans)
+    {
+        int outPort = getRoute(trans).outputPortNumber;
+        if (targetResponse[outPort] != &trans)
+        {
+            return;
+        }
+        targetResponse[outPort] = 0;
+
+        tlm::tlm_phase phase = tlm::END_RESP;
+        sc_time delay = SC_ZERO_TIME;
+        iSocket[outPort]->nb_transport_fw(trans, phase, delay); // Ignore return
+    }
+
+    // The frame this interconnect pushed in routeFW
+    const routingExtension::frame &getRoute(tlm::tlm_generic_payload &trans)
+    {
+        static const routingExtension::frame none = {0, 0, 0, 0};
+
+        routingExtension *ext = nullptr;
+        trans.get_extension(ext);
+        const routingExtension::frame *route = ext ? ext->find(this) : 0;
+        if (route == 0)
+        {
+            SC_REPORT_FATAL(name(), "Transaction was not routed here");
+            return none;
+        }
+        return *route;
+    }
+
+    // Undo the address translation of routeFW
+    void restoreAddress(tlm::tlm_generic_payload &trans)
+    {
+        trans.set_address(getRoute(trans).address);
+    }
+
+    // Pops the routing frame and drops the reference of BEGIN_REQ
+    void completeTransaction(tlm::tlm_generic_payload &trans)
     {
         routingExtension *ext = nullptr;
         trans.get_extension(ext);
-        int inPort = ext->getInputPortNumber();
+        ext->pop(this);
+        trans.release();
+    }
+
+    virtual bool get_direct_mem_ptr(int id,
+                                    tlm::tlm_generic_payload &trans,
+                                    tlm::tlm_dmi &dmi)
+    {
+        sc_dt::uint64 address = trans.get_address();
+        const addressMap::region *region = memoryMap.decode(address);
+
+        if (region == 0)
+        {
+            // Hole in the memory map, nothing to grant
+            dmi.allow_none();
+            dmi.set_start_address(address);
+            dmi.set_end_address(address);
+            return false;
+        }
+
+        trans.set_address(region->toLocal(address));
+        bool granted = iSocket[region->port]->get_direct_mem_ptr(trans, dmi);
+        trans.set_address(address);
+
+        return translateDMI(*region, granted, dmi);
+    }
 
-        return tSocket[inPort]->nb_transport_bw(trans, phase, delay);
+    // Clips the target's range to the region and translates it back into
+    // the global memory map
+    static bool translateDMI(const addressMap::region &region,
+                             bool granted,
+                             tlm::tlm_dmi &dmi)
+    {
+        sc_dt::uint64 start = dmi.get_start_address();
+        sc_dt::uint64 end = dmi.get_end_address();
+        sc_dt::uint64 regionEnd = region.offset + (region.size - 1);
+
+        if (start < region.offset)
+        {
+            if (granted)
+            {
+                dmi.set_dmi_ptr(dmi.get_dmi_ptr() + (region.offset - start));
+            }
+            start = region.offset;
+        }
+        if (end > regionEnd)
+        {
+            end = regionEnd;
+        }
+        if (end < start)
+        {
+            dmi.allow_none();
+            return false;
+        }
+
+        dmi.set_start_address(region.toGlobal(start));
+        dmi.set_end_address(region.toGlobal(end));
+        return granted;
+    }
+
+    // TLM-2 debug transport method
+    virtual unsigned int transport_dbg(int id,
+                                       tlm::tlm_generic_payload &trans)
+    {
+        sc_dt::uint64 address = trans.get_address();
+        unsigned char *data = trans.get_data_ptr();
+        unsigned int length = trans.get_data_length();
+        unsigned int count = 0;
+
+        // A debug access may span several targets: it is split at the
+        // region boundaries and stops at a hole or a short transfer
+        while (count < length)
+        {
+            const addressMap::region *region = memoryMap.decode(address + count);
+            if (region == 0)
+            {
+                break;
+            }
+
+            unsigned int chunk = length - count;
+            if (chunk > region->end() - (address + count) + 1)
+            {
+                chunk = region->end() - (address + count) + 1;
+            }
+            trans.set_address(region->toLocal(address + count));
+            trans.set_data_ptr(data + count);
+            trans.set_data_length(chunk);
+
+            unsigned int transferred = iSocket[region->port]->transport_dbg(trans);
+            count += transferred;
+            if (transferred < chunk)
+            {
+                break;
+            }
+        }
+
+        trans.set_address(address);
+        trans.set_data_ptr(data);
+        trans.set_data_length(length);
+        return count;
+    }
+
+    virtual void invalidate_direct_mem_ptr(int id,
+                                           sc_dt::uint64 start_range,
+                                           sc_dt::uint64 end_range)
+    {
+        // Translate the target's range into every region that maps it
+        for (const addressMap::region &region : memoryMap.getRegions())
+        {
+            sc_dt::uint64 regionEnd = region.offset + (region.size - 1);
+            if (region.port != id
+                || start_range > regionEnd || end_range < region.offset)
+            {
+                continue;
+            }
+
+            sc_dt::uint64 start = std::max(start_range, region.offset);
+            sc_dt::uint64 end = std::min(end_range, regionEnd);
+
+            // Any initiator may hold a pointer into the range
+            for (unsigned int i = 0; i < tSocket.size(); i++)
+            {
+                tSocket[i]->invalidate_direct_mem_ptr(region.toGlobal(start),
+                                                      region.toGlobal(end));
+            }
+        }
     }
 };
\ No newline at end of file
@@ -9,19 +9,30 @@
 
 int sc_main (int, char **)
 {
-    processor cpu0("cpu0");    
-    processor cpu1("cpu1");
+    // Both processors allocate their transactions from one shared pool
+    MemoryManager pool;
 
-    memory<512> memory0("memory0");
-    memory<512> memory1("memory1");
+    processor cpu0("cpu0", &pool);
+    // cpu1 completes its responses on the return path [2.1]
+    processor cpu1("cpu1", &pool, 4, RETURN_PATH);
 
-    interconnect bus("bus0");
+    // Pipelined targets: four transactions in execution, four responses queued
+    memory<512> memory0("memory0", 0, 4, 4);
+    // memory1 answers BEGIN_REQ directly with BEGIN_RESP [4.0]
+    memory<512> memory1("memory1", 0, 4, 4, SKIP_END_REQ);
+
+    // Both processors share the memories, requests are arbitrated per memory
+    interconnect bus("bus0", ROUND_ROBIN);
 
     cpu0.iSocket.bind(bus.tSocket);
     cpu1.iSocket.bind(bus.tSocket);
     bus.iSocket.bind(memory0.tSocket);
     bus.iSocket.bind(memory1.tSocket);
 
+    // Memory map: two 512 byte regions, each at address 0 of its memory
+    bus.addRegion(0, 512, 0);
+    bus.addRegion(512, 512, 1);
+
     // std::cout << std::endl << "Name "
     //           << std::setfill(' ') << std::setw(10)
     //           << "Time" << " "
@@ -39,5 +50,6 @@ int sc_main (int, char **)
     sc_start();
 
     std::cout << std::endl;
+    pool.printStatistics(std::cout, "pool");
     return 0;
 }
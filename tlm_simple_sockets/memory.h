@@ -34,10 +34,12 @@
 
 #ifndef MEMORY_H
 #define MEMORY_H
+#include <deque>
 #include <iomanip>
 #include <systemc>
 #include <tlm.h>
 #include <tlm_utils/peq_with_cb_and_phase.h>
+#include <tlm_utils/peq_with_get.h>
 #include <tlm_utils/multi_passthrough_initiator_socket.h>
 #include <tlm_utils/multi_passthrough_target_socket.h>
 #include <tlm_utils/simple_initiator_socket.h>
@@ -45,22 +47,117 @@
 #include "../tlm_memory_manager/memory_manager.h"
 #include "../tlm_protocol_checker/tlm2_base_protocol_checker.h"
 #include "util.h"
+#include "backing_store.h"
 
 using namespace sc_core;
 using namespace sc_dt;
 using namespace std;
 
-template <unsigned int SIZE = 1024>
+// Access-width policies of memory. They select at compile time which
+// accesses to a contiguous store bypass the generic path of
+// executeTransaction() and become a single load or store. Fast accesses
+// have no byte enables or streaming and are not traced.
+
+// Every access takes the generic path
+struct genericAccess
+{
+    static bool access(tlm::tlm_command cmd,
+                       unsigned char *target,
+                       sc_dt::uint64 address,
+                       unsigned char *data,
+                       unsigned int length)
+    {
+        return false;
+    }
+};
+
+// Naturally aligned accesses of WIDTH bytes
+template <unsigned int WIDTH>
+struct fixedAccess
+{
+    static_assert(WIDTH == 1 || WIDTH == 2 || WIDTH == 4 || WIDTH == 8,
+                  "Fixed accesses are 1, 2, 4 or 8 bytes wide");
+
+    static bool access(tlm::tlm_command cmd,
+                       unsigned char *target,
+                       sc_dt::uint64 address,
+                       unsigned char *data,
+                       unsigned int length)
+    {
+        if (length != WIDTH || (address & (WIDTH - 1)) != 0)
+        {
+            return false;
+        }
+
+        // Constant-size copies compile to a single load and store
+        if (cmd == tlm::TLM_WRITE_COMMAND)
+        {
+            memcpy(target, data, WIDTH);
+        }
+        else if (cmd == tlm::TLM_READ_COMMAND)
+        {
+            memcpy(data, target, WIDTH);
+        }
+        return true;
+    }
+};
+
+// Naturally aligned accesses of 1, 2, 4 or 8 bytes
+struct alignedAccess
+{
+    static bool access(tlm::tlm_command cmd,
+                       unsigned char *target,
+                       sc_dt::uint64 address,
+                       unsigned char *data,
+                       unsigned int length)
+    {
+        switch (length)
+        {
+            case 1: return fixedAccess<1>::access(cmd, target, address,
+                                                  data, length);
+            case 2: return fixedAccess<2>::access(cmd, target, address,
+                                                  data, length);
+            case 4: return fixedAccess<4>::access(cmd, target, address,
+                                                  data, length);
+            case 8: return fixedAccess<8>::access(cmd, target, address,
+                                                  data, length);
+            default: return false;
+        }
+    }
+};
+
+// SIZE is the size of the default flat store. Other stores, e.g. a sparse
+// pagedStore with a 64-bit size, can be handed to the constructor. ACCESS
+// is one of the access-width policies above.
+//
+// The AT target is pipelined: up to requestQueueDepth transactions are
+// accepted (END_REQ) and executed concurrently, and up to
+// responseQueueDepth executed transactions wait for their BEGIN_RESP.
+// Further BEGIN_REQs are back-pressured by deferring their END_REQ.
+// The protocol mode selects the full 4-phase exchange or one of the
+// shortcuts, which save calls and PEQ events at the cost of detail.
+template <unsigned int SIZE = 1024, typename ACCESS = genericAccess>
 SC_MODULE(memory){
 
     private: 
 
-    tlm::tlm_generic_payload* transactionInProgress;
-    sc_event targetDone;
-    bool responseInProgress;
-    tlm::tlm_generic_payload* nextResponsePending;
-    tlm::tlm_generic_payload* endRequestPending;
+    unsigned int requestQueueDepth;
+    unsigned int responseQueueDepth;
+    protocolMode mode;
+
+    // BEGIN_REQ received, END_REQ deferred:
+    std::deque<tlm::tlm_generic_payload*> pendingRequests;
+    // Accepted and not yet in the response queue:
+    unsigned int requestsInExecution;
+    // Executed, waiting for space in the response queue:
+    std::deque<tlm::tlm_generic_payload*> executedRequests;
+    // Executed, waiting for BEGIN_RESP:
+    std::deque<tlm::tlm_generic_payload*> responseQueue;
+    // BEGIN_RESP sent, waiting for END_RESP:
+    tlm::tlm_generic_payload* responseInProgress;
+
     tlm_utils::peq_with_cb_and_phase<memory> peq;
+    tlm_utils::peq_with_get<tlm::tlm_generic_payload> executionPeq;
 
     sc_time randomDelay()
     {
@@ -68,32 +165,104 @@ SC_MODULE(memory){
         return sc_time(nanoseconds, SC_NS);
     }
 
-    unsigned char *mem;     
+    backingStore *store; // owned by the memory
+    unsigned char *fastMem; // start of a contiguous store, otherwise 0
+
+    // Latencies announced to initiators that access the store through DMI
+    sc_time dmiReadLatency;
+    sc_time dmiWriteLatency;
 
     public:
 
     tlm_utils::simple_target_socket<memory> tSocket;
 
-    memory(sc_module_name name)
+    memory(sc_module_name name,
+           backingStore *store = 0,
+           unsigned int requestQueueDepth = 1,
+           unsigned int responseQueueDepth = 1,
+           protocolMode mode = FOUR_PHASE)
         : sc_module(name),
         tSocket("memory socket"),
-        transactionInProgress(0),
-        responseInProgress(false),
-        nextResponsePending(0),
-        endRequestPending(0),
-        peq(this, &memory::peqCallback)
+        requestQueueDepth(requestQueueDepth),
+        responseQueueDepth(responseQueueDepth),
+        mode(mode),
+        requestsInExecution(0),
+        responseInProgress(0),
+        peq(this, &memory::peqCallback),
+        executionPeq("executionPeq"),
+        dmiReadLatency(10, SC_NS),
+        dmiWriteLatency(10, SC_NS)
     {
+        this->store = store ? store : new flatStore(SIZE);
+
+        // Only contiguous stores keep their host array for their lifetime
+        contiguousStore *contiguous = dynamic_cast<contiguousStore *>(
+                                          this->store);
+        sc_dt::uint64 start;
+        sc_dt::uint64 end;
+        fastMem = contiguous ? contiguous->directPointer(0, start, end) : 0;
+
         tSocket.register_b_transport(this, &memory::b_transport);
         tSocket.register_nb_transport_fw(this, &memory::nb_transport_fw);
-        mem = new unsigned char[SIZE];
+        tSocket.register_get_direct_mem_ptr(this, &memory::get_direct_mem_ptr);
+        tSocket.register_transport_dbg(this, &memory::transport_dbg);
 
         SC_METHOD(executeTransactionProcess);
-        sensitive << targetDone;
+        sensitive << executionPeq.get_event();
         dont_initialize();
     }
     SC_HAS_PROCESS(memory);
 
-    ~memory(){free(mem);}
+    ~memory(){delete store;}
+
+    void end_of_simulation()
+    {
+        store->flush();
+    }
+
+    // Checkpoints of the contents, e.g. to start many runs from one
+    // warmed-up state. See backingStore for the file format.
+    bool saveCheckpoint(const std::string &path)
+    {
+        return store->saveCheckpoint(path);
+    }
+
+    bool restoreCheckpoint(const std::string &path)
+    {
+        // Initiators may hold DMI pointers into pages that are replaced
+        invalidateDirectMemory();
+        return store->loadCheckpoint(path);
+    }
+
+    // Copy-on-write snapshots of the contents, e.g. to roll back and retry
+    // a phase of the simulation. They require a pagedStore.
+    unsigned int takeSnapshot()
+    {
+        // DMI pointers would write into the pages shared with the snapshot
+        invalidateDirectMemory();
+        return store->takeSnapshot();
+    }
+
+    void restoreSnapshot(unsigned int snapshot)
+    {
+        invalidateDirectMemory();
+        store->restoreSnapshot(snapshot);
+    }
+
+    void releaseSnapshot(unsigned int snapshot)
+    {
+        store->releaseSnapshot(snapshot);
+    }
+
+    // Lets the store reduce its host memory, e.g. a pagedStore drops zero
+    // pages, shares equal pages and compresses cold pages. Returns the
+    // number of bytes held afterwards.
+    sc_dt::uint64 compact()
+    {
+        // DMI pointers may refer to pages that are freed or shared
+        invalidateDirectMemory();
+        return store->compact();
+    }
 
     virtual void b_transport(tlm::tlm_generic_payload& trans,
                              sc_time& delay)
@@ -106,69 +275,64 @@ SC_MODULE(memory){
                                                tlm::tlm_phase& phase,
                                                sc_time& delay)
     {
+        if (phase == tlm::BEGIN_REQ && mode == EARLY_COMPLETION) // [3.0]
+        {
+            // Execute right away and annotate the latency, no further
+            // phases are exchanged
+            executeTransaction(trans);
+            delay = delay + randomDelay();
+            return tlm::TLM_COMPLETED;
+        }
+
+        if (phase == tlm::BEGIN_REQ && mode == RETURN_PATH // [2.0]
+            && canAccept())
+        {
+            // Accept on the return path instead of calling back with END_REQ
+            trans.acquire();
+            delay = delay + randomDelay(); // Accept delay
+            startExecution(trans, delay);
+            phase = tlm::END_REQ;
+            return tlm::TLM_UPDATED;
+        }
+
         // Queue the transaction into the peq until
         // the annotated time has elapsed
         peq.notify( trans, phase, delay);
 
-        // HINT: Implementation of:
-        //       - Return Path Shortcuts [2.0]
-        //       - Early Completion [3.0]
-        //       - Skip END_REQ [4.0]
-        // should be here
-
         return tlm::TLM_ACCEPTED; // [1.1, 1.7, (1.8)]
     }
 
     void peqCallback(tlm::tlm_generic_payload& trans,
                      const tlm::tlm_phase& phase)
     {
-        sc_time delay;
-
         if(phase == tlm::BEGIN_REQ) // [1.0]
         {
             // Increment the transaction reference count
             trans.acquire();
 
-            if (!transactionInProgress)
+            if (canAccept())
             {
-                sendEndRequest(trans); // [1.2]
-                // HINT: instead of [1.2] we can call also [4.1] (ie. [1.4])
+                acceptRequest(trans); // [1.2] or [4.1]
             }
             else
             {
                 // Put back-pressure on initiator by deferring END_REQ
-                endRequestPending = &trans;
+                pendingRequests.push_back(&trans);
             }
         }
         else if (phase == tlm::END_RESP) // [1.6]
         {
-            // On receiving END_RESP, the target can release the transaction
-            // and allow other pending transactions to proceed
+            // On receiving END_RESP, the target can issue the next
+            // BEGIN_RESP and allow pending transactions to proceed
 
-            if (!responseInProgress)
+            if (&trans != responseInProgress)
             {
                 SC_REPORT_FATAL("TLM-2",
                    "Illegal transaction phase END_RESP received by target");
             }
 
-            // Flag must only be cleared when END_RESP is sent
-            transactionInProgress = 0;
-
-            // Target itself is now clear to issue the next BEGIN_RESP
-            responseInProgress = false;
-            if (nextResponsePending)
-            {
-                sendResponse(*nextResponsePending);
-                nextResponsePending = 0;
-            }
-
-            // ... and to unblock the initiator by issuing END_REQ
-            if (endRequestPending)
-            {
-                sendEndRequest(*endRequestPending);
-                endRequestPending = 0;
-            }
-
+            responseInProgress = 0;
+            advancePipeline();
         }
         else // tlm::END_REQ or tlm::BEGIN_RESP
         {
@@ -176,106 +340,314 @@ SC_MODULE(memory){
         }
     }
 
-    void sendEndRequest(tlm::tlm_generic_payload& trans)
+    bool canAccept() const
     {
-        tlm::tlm_phase bw_phase;
-        sc_time delay;
+        return requestsInExecution < requestQueueDepth
+            && pendingRequests.empty();
+    }
 
-        // Queue the acceptance and the response with the appropriate latency
-        bw_phase = tlm::END_REQ;
-        delay = randomDelay(); // Accept delay
+    void acceptRequest(tlm::tlm_generic_payload& trans)
+    {
+        sc_time delay = randomDelay(); // Accept delay
 
-        tlm::tlm_sync_enum status;
-        status = tSocket->nb_transport_bw( trans, bw_phase, delay ); // [1.2]
-        // Ignore return value (has to be TLM_ACCEPTED anyway)
-        // initiator cannot terminate transaction at this point
+        if (mode != SKIP_END_REQ)
+        {
+            tlm::tlm_phase bw_phase = tlm::END_REQ;
+            tSocket->nb_transport_bw( trans, bw_phase, delay ); // [1.2]
+            // Ignore return value (has to be TLM_ACCEPTED anyway)
+            // initiator cannot terminate transaction at this point
+        }
+        // Otherwise the BEGIN_RESP ends the request phase as well [4.0]
 
-        // Queue internal event to mark beginning of response
-        delay = delay + randomDelay(); // Latency
-        targetDone.notify( delay );
+        startExecution(trans, delay);
+    }
+
+    void startExecution(tlm::tlm_generic_payload& trans, const sc_time& delay)
+    {
+        // Queue internal event to mark the end of the execution
+        executionPeq.notify( trans, delay + randomDelay() ); // Latency
 
-        assert(transactionInProgress == 0);
-        transactionInProgress = &trans;
+        requestsInExecution++;
     }
 
-    // Method process that runs on targetDone
+    // Method process that runs when transactions finish their latency
     void executeTransactionProcess()
     {
-        // Execute the read or write commands
-        executeTransaction(*transactionInProgress);
+        tlm::tlm_generic_payload* trans;
+        while ((trans = executionPeq.get_next_transaction()) != 0)
+        {
+            // Execute the read or write commands
+            executeTransaction(*trans);
+            executedRequests.push_back(trans);
+        }
+
+        advancePipeline();
+    }
 
-        // Target must honor BEGIN_RESP/END_RESP exclusion rule
-        // i.e. must not send BEGIN_RESP until receiving previous
-        // END_RESP or BEGIN_REQ
-        if (responseInProgress)
+    // Moves transactions on as far as the queues and the BEGIN_RESP/END_RESP
+    // exclusion rule allow. A response completed on the return path [3.1]
+    // frees the response queue again, so the stages are repeated until a
+    // pass makes no progress.
+    void advancePipeline()
+    {
+        bool progress = true;
+        while (progress)
         {
-            // Target allows only two transactions in-flight
-            if (nextResponsePending)
+            progress = false;
+
+            while (!executedRequests.empty()
+                   && responseQueue.size() < responseQueueDepth)
+            {
+                responseQueue.push_back(executedRequests.front());
+                executedRequests.pop_front();
+                requestsInExecution--;
+                progress = true;
+            }
+
+            // Target must honor BEGIN_RESP/END_RESP exclusion rule
+            // i.e. must not send BEGIN_RESP until receiving previous
+            // END_RESP or BEGIN_REQ
+            while (!responseInProgress && !responseQueue.empty())
             {
-                SC_REPORT_FATAL(name(),
-                   "Attempt to have two pending responses in target");
+                tlm::tlm_generic_payload* trans = responseQueue.front();
+                responseQueue.pop_front();
+                sendResponse(*trans);
+                progress = true;
+            }
+
+            // Unblock initiators by issuing deferred END_REQs
+            while (!pendingRequests.empty()
+                   && requestsInExecution < requestQueueDepth)
+            {
+                tlm::tlm_generic_payload* trans = pendingRequests.front();
+                pendingRequests.pop_front();
+                acceptRequest(*trans);
+                progress = true;
             }
-            nextResponsePending = transactionInProgress;
         }
-        else
+    }
+
+    // Fast path selected by the access-width policy
+    bool fastTransaction(tlm::tlm_generic_payload& trans)
+    {
+        sc_dt::uint64 adr = trans.get_address();
+        unsigned int  len = trans.get_data_length();
+
+        if (fastMem == 0
+            || trans.get_byte_enable_ptr() != 0
+            || trans.get_streaming_width() < len
+            || adr >= store->size() || len > store->size() - adr
+            || !ACCESS::access(trans.get_command(), fastMem + adr, adr,
+                               trans.get_data_ptr(), len))
         {
-            sendResponse(*transactionInProgress);
+            return false;
         }
+
+        trans.set_dmi_allowed(true);
+        trans.set_response_status(tlm::TLM_OK_RESPONSE);
+        return true;
     }
 
     // Common to b_transport and nb_transport
     void executeTransaction(tlm::tlm_generic_payload& trans)
     {
+        if (fastTransaction(trans))
+        {
+            return;
+        }
+
         tlm::tlm_command cmd = trans.get_command();
         sc_dt::uint64    adr = trans.get_address();
         unsigned char*   ptr = trans.get_data_ptr();
         unsigned int     len = trans.get_data_length();
         unsigned char*   byt = trans.get_byte_enable_ptr();
+        unsigned int     bel = trans.get_byte_enable_length();
         unsigned int     wid = trans.get_streaming_width();
 
-        if (byt != 0) {
+        if (byt != 0 && bel == 0) {
             trans.set_response_status( tlm::TLM_BYTE_ENABLE_ERROR_RESPONSE );
             return;
         }
-        if (len > 4 || wid < len) {
+        if (len == 0 || wid == 0) {
             trans.set_response_status( tlm::TLM_BURST_ERROR_RESPONSE );
             return;
         }
 
-        if(trans.get_command() == tlm::TLM_WRITE_COMMAND)
-        {            
-            memcpy(
-                &mem[trans.get_address()],
-                trans.get_data_ptr(),
-                trans.get_data_length()
-            );
+        // With a streaming width below the data length every beat of wid
+        // bytes accesses the same addresses, e.g. a FIFO register
+        unsigned int beat = (wid < len) ? wid : len;
+
+        if (adr >= store->size() || beat > store->size() - adr) {
+            trans.set_response_status( tlm::TLM_ADDRESS_ERROR_RESPONSE );
+            return;
         }
-        else // (trans.get_command() == tlm::TLM_READ_COMMAND)
+
+        if (cmd != tlm::TLM_IGNORE_COMMAND)
+        {
+            for (unsigned int offset = 0; offset < len; offset += beat)
+            {
+                unsigned int n = (len - offset < beat) ? len - offset : beat;
+
+                if (cmd == tlm::TLM_WRITE_COMMAND)
+                {
+                    if (byt)
+                    {
+                        store->writeMasked(adr, ptr + offset, n,
+                                           byt, bel, offset);
+                    }
+                    else
+                    {
+                        store->write(adr, ptr + offset, n);
+                    }
+                }
+                else // (cmd == tlm::TLM_READ_COMMAND)
+                {
+                    if (byt)
+                    {
+                        store->readMasked(adr, ptr + offset, n,
+                                          byt, bel, offset);
+                    }
+                    else
+                    {
+                        store->read(adr, ptr + offset, n);
+                    }
+                }
+            }
+        }
+
+        if (cmd == tlm::TLM_WRITE_COMMAND)
         {
-            memcpy(
-                trans.get_data_ptr(),
-                &mem[trans.get_address()],
-                trans.get_data_length()
-            );
+            invalidateStaleReadPointers();
         }
 
         cout << "\033[1;32m"
              << "(T) @"  << setfill(' ') << setw(12) << sc_time_stamp()
              << ": " << setw(12) << (cmd ? "Exec. Write " : "Exec. Read ")
              << "Addr = " << setw(4) << adr << setw(12)
-             << " Data = " << ptr[0] << ptr[1] << ptr[2] << ptr[3]
-             << "\033[0m" << endl;
+             << " Data = ";
+        for (unsigned int i = 0; i < len && i < 4; i++)
+        {
+            cout << ptr[i];
+        }
+        cout << "\033[0m" << endl;
 
+        // Hint to the initiator that it can use DMI for this address
+        trans.set_dmi_allowed(true);
         trans.set_response_status(tlm::TLM_OK_RESPONSE);
     }
 
+    // Read-only DMI blocks may be replaced by a write, e.g. the shared
+    // zeros of an absent page
+    void invalidateStaleReadPointers()
+    {
+        sc_dt::uint64 start;
+        sc_dt::uint64 end;
+        if (store->staleReadPointers(start, end))
+        {
+            tSocket->invalidate_direct_mem_ptr(start, end);
+        }
+    }
+
+    void invalidateDirectMemory()
+    {
+        // Before simulation no DMI pointers have been handed out
+        if (sc_core::sc_start_of_simulation_invoked())
+        {
+            tSocket->invalidate_direct_mem_ptr(0, ~sc_dt::uint64(0));
+        }
+    }
+
+    // TLM-2 forward DMI method
+    virtual bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
+                                    tlm::tlm_dmi& dmi_data)
+    {
+        sc_dt::uint64 start;
+        sc_dt::uint64 end;
+        bool writable = true;
+        unsigned char *ptr;
+
+        // E.g. a region of the address map that is larger than the store
+        if (trans.get_address() >= store->size())
+        {
+            dmi_data.allow_none();
+            return false;
+        }
+
+        // A read request must not allocate storage, e.g. pages of a
+        // pagedStore, so it may only be granted read access
+        if (trans.get_command() == tlm::TLM_READ_COMMAND)
+        {
+            ptr = store->readPointer(trans.get_address(), start, end,
+                                     writable);
+        }
+        else
+        {
+            ptr = store->directPointer(trans.get_address(), start, end);
+
+            // The writable block may replace one that other initiators
+            // hold read-only
+            invalidateStaleReadPointers();
+        }
+
+        if (ptr == 0)
+        {
+            dmi_data.allow_none();
+            return false;
+        }
+
+        // The contiguous block of the store
+        dmi_data.set_dmi_ptr(ptr);
+        dmi_data.set_start_address(start);
+        dmi_data.set_end_address(end);
+        dmi_data.set_read_latency(dmiReadLatency);
+        dmi_data.set_write_latency(dmiWriteLatency);
+        if (writable)
+        {
+            dmi_data.allow_read_write();
+        }
+        else
+        {
+            dmi_data.allow_read();
+        }
+        return true;
+    }
+
+    // TLM-2 debug transport method: zero-time bulk access of any length,
+    // clipped to the end of the store
+    virtual unsigned int transport_dbg(tlm::tlm_generic_payload& trans)
+    {
+        tlm::tlm_command cmd = trans.get_command();
+        sc_dt::uint64    adr = trans.get_address();
+        unsigned int     len = trans.get_data_length();
+
+        if (adr >= store->size() || cmd == tlm::TLM_IGNORE_COMMAND)
+        {
+            return 0;
+        }
+        if (len > store->size() - adr)
+        {
+            len = store->size() - adr;
+        }
+
+        if (cmd == tlm::TLM_WRITE_COMMAND)
+        {
+            store->write(adr, trans.get_data_ptr(), len);
+            invalidateStaleReadPointers();
+        }
+        else
+        {
+            store->read(adr, trans.get_data_ptr(), len);
+        }
+        return len;
+    }
+
     void sendResponse(tlm::tlm_generic_payload& trans)
     {
         tlm::tlm_sync_enum status;
         tlm::tlm_phase bw_phase;
         sc_time delay;
 
-        responseInProgress = true;
+        responseInProgress = &trans;
         bw_phase = tlm::BEGIN_RESP;
         delay = SC_ZERO_TIME;
         status = tSocket->nb_transport_bw( trans, bw_phase, delay ); // [1.4]
@@ -288,8 +660,7 @@ SC_MODULE(memory){
         else if (status == tlm::TLM_COMPLETED) // [3.1]
         {
             // The initiator has terminated the transaction
-            transactionInProgress = 0;
-            responseInProgress = false;
+            responseInProgress = 0;
         }
         // In the case of TLM_ACCEPTED [1.5] we will recv. a FW call [1.6]
 
@@ -39,6 +39,8 @@
 #include <systemc>
 #include <tlm.h>
 #include <random>
+#include <vector>
+#include <queue>
 #include <tlm_utils/peq_with_cb_and_phase.h>
 #include <tlm_utils/multi_passthrough_initiator_socket.h>
 #include <tlm_utils/multi_passthrough_target_socket.h>
@@ -59,21 +61,54 @@ SC_MODULE(processor)
     
     tlm_utils::simple_initiator_socket<processor> iSocket;
 
-    SC_CTOR(processor)
-        : iSocket("processor intiator socket"),
+    // Without a pool the processor allocates from a pool of its own,
+    // otherwise from the given pool that may be shared with other
+    // initiators, through a small local cache of cacheSize payloads.
+    // The protocol mode selects how responses are completed: END_RESP on
+    // the forward path, on the return path [2.1] or not at all [3.1].
+    processor(sc_module_name name,
+              MemoryManager *pool = 0,
+              unsigned int cacheSize = 4,
+              protocolMode mode = FOUR_PHASE)
+        : sc_module(name),
+        iSocket("processor intiator socket"),
+        mode(mode),
+        mm(pool ? *pool : ownPool, cacheSize),
         requestInProgress(0),
         peq(this, &processor::peqCallback)
     {
         iSocket.register_nb_transport_bw(this, &processor::nb_transport_bw);
+        iSocket.register_invalidate_direct_mem_ptr(this,
+                &processor::invalidate_direct_mem_ptr);
         SC_THREAD(processRandom);    
+        SC_THREAD(processChecks);
+    }
+    SC_HAS_PROCESS(processor);
+
+    // Report the payload pool, e.g. to spot leaked transactions. Called
+    // from sc_main after sc_start(): end_of_simulation() only runs after
+    // sc_stop(), which the example never calls.
+    void printStatistics(std::ostream& out)
+    {
+        // A shared pool is reported by its owner
+        if (&mm.getPool() == &ownPool)
+        {
+            ownPool.printStatistics(out, name());
+        }
     }
 
     private:
 
-    MemoryManager mm;    
+    protocolMode mode;
+    MemoryManager ownPool;
+    PayloadCache mm;
     tlm::tlm_generic_payload* requestInProgress;
     sc_event endRequest;
     tlm_utils::peq_with_cb_and_phase<processor> peq;
+    std::vector<tlm::tlm_dmi> dmiRegions; // granted by the targets
+    static const unsigned int MAX_DMI_REGIONS = 16;
+    std::queue<tlm::tlm_generic_payload*> completed; // awaiting checkValue()
+    sc_event completedEvent;
 
     void processRandom()
     {
@@ -88,33 +123,27 @@ SC_MODULE(processor)
         // generate a sequence of random writes
         for(int i=0; i<10; i++)
         {        
-            unsigned char *data;
-            data = new unsigned char[4];
-
             // generate random address 
             int addr = distrAddr(randGenerator);
             
-            // generat random data
-            for(int i=0; i<4; i++)
-            {
-                data[i] = distData(randGenerator);
-            }
-
             // write a random value to a random address
             tlm::tlm_command cmd = tlm::TLM_WRITE_COMMAND;
 
-            // get a new transaction from memory manager
-            trans = mm.allocate();
+            // get a new transaction with a 4 byte data buffer from memory manager
+            trans = mm.allocate(4);
             trans->acquire();        
             trans->set_command(cmd);
             trans->set_address(addr);
-            trans->set_data_ptr(data);
-            trans->set_data_length(4);
-            trans->set_streaming_width(4);
-            trans->set_byte_enable_ptr(0);
             trans->set_dmi_allowed(false);
             trans->set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
 
+            // generat random data
+            unsigned char *data = trans->get_data_ptr();
+            for(int i=0; i<4; i++)
+            {
+                data[i] = distData(randGenerator);
+            }
+
             // BEGIN_REQ/END_REQ exclusion rule
             if(requestInProgress)
             {
@@ -150,8 +179,7 @@ SC_MODULE(processor)
                 // necessarily ends the BEGIN_REQ phase
                 requestInProgress = 0;                        
 
-                // Allow the memory manager to free the transaction object
-                trans->release();
+                finishTransaction(*trans);
             }
             // In the case of TLM_ACCEPTED [1.1] we
             // will recv. a BW call in the future [1.2, 1.4]
@@ -165,12 +193,32 @@ SC_MODULE(processor)
                                                 tlm::tlm_phase& phase,
                                                 sc_time& delay)
     {
+        if (phase == tlm::BEGIN_RESP && mode != FOUR_PHASE
+            && mode != SKIP_END_REQ)
+        {
+            if (&trans == requestInProgress) // [4.0]
+            {
+                requestInProgress = 0;
+                endRequest.notify(delay);
+            }
+
+            finishTransaction(trans);
+
+            if (mode == EARLY_COMPLETION) // [3.1]
+            {
+                return tlm::TLM_COMPLETED;
+            }
+
+            // Complete the response on the return path [2.1]
+            phase = tlm::END_RESP;
+            delay = delay + randomDelay();
+            return tlm::TLM_UPDATED;
+        }
+
         // Queue the transaction into the peq until
         // the annotated time has elapsed
         peq.notify(trans, phase, delay);
 
-        // HINT: a Return Path shortcut can be implemented here [2.1]
-
         return tlm::TLM_ACCEPTED; // [1.3, 1.5]
     }
 
@@ -197,14 +245,158 @@ SC_MODULE(processor)
             sc_time delay = sc_time(randomDelay());
             // [1.6]
             iSocket->nb_transport_fw( trans, fw_phase, delay ); // Ignore return
-            
-            if(trans.get_command() == tlm::TLM_WRITE_COMMAND)
+
+            finishTransaction(trans);
+        }
+    }
+
+    // Called once per transaction when its response has been received.
+    // The read back is left to processChecks(): the transaction may not be
+    // reused before its final phase has been sent, and a callback on the
+    // backward path or from the peq runs in a method context where a
+    // b_transport call cannot wait.
+    void finishTransaction(tlm::tlm_generic_payload& trans)
+    {
+        completed.push(&trans);
+        completedEvent.notify(SC_ZERO_TIME);
+    }
+
+    void processChecks()
+    {
+        while (true)
+        {
+            wait(completedEvent);
+
+            while (!completed.empty())
+            {
+                tlm::tlm_generic_payload *trans = completed.front();
+                completed.pop();
+
+                if(trans->get_command() == tlm::TLM_WRITE_COMMAND)
+                {
+                    checkValue(*trans);
+                }
+
+                // Allow the memory manager to free the transaction object
+                trans->release();
+            }
+        }
+    }
+
+    // Loosely-timed access: served through a plain pointer access if a
+    // DMI region covers it, otherwise with b_transport
+    void ltTransport(tlm::tlm_generic_payload& trans, sc_time& delay)
+    {
+        if (dmiTransport(trans, delay))
+        {
+            return;
+        }
+
+        iSocket->b_transport(trans, delay);
+
+        // The target hints that it grants DMI for this address:
+        if (trans.is_dmi_allowed())
+        {
+            tlm::tlm_dmi dmi;
+            if (iSocket->get_direct_mem_ptr(trans, dmi))
+            {
+                addDmiRegion(dmi);
+            }
+        }
+    }
+
+    // A contiguous store is granted in one block, a paged store page by
+    // page. Regions that are already cached are skipped, regions that
+    // continue each other in host memory are merged and the list is
+    // bounded, so the lookup in dmiTransport() stays short.
+    void addDmiRegion(const tlm::tlm_dmi& dmi)
+    {
+        for (tlm::tlm_dmi& region : dmiRegions)
+        {
+            if (region.get_start_address() <= dmi.get_start_address()
+                && region.get_end_address() >= dmi.get_end_address()
+                && (region.get_granted_access() & dmi.get_granted_access())
+                   == dmi.get_granted_access())
+            {
+                return;
+            }
+
+            if (region.get_granted_access() == dmi.get_granted_access()
+                && region.get_read_latency() == dmi.get_read_latency()
+                && region.get_write_latency() == dmi.get_write_latency()
+                && region.get_end_address() + 1 == dmi.get_start_address()
+                && region.get_dmi_ptr() + (dmi.get_start_address()
+                                           - region.get_start_address())
+                   == dmi.get_dmi_ptr())
+            {
+                region.set_end_address(dmi.get_end_address());
+                return;
+            }
+        }
+
+        if (dmiRegions.size() >= MAX_DMI_REGIONS)
+        {
+            dmiRegions.erase(dmiRegions.begin());
+        }
+        dmiRegions.push_back(dmi);
+    }
+
+    bool dmiTransport(tlm::tlm_generic_payload& trans, sc_time& delay)
+    {
+        sc_dt::uint64 start = trans.get_address();
+        sc_dt::uint64 end = start + trans.get_data_length() - 1;
+        bool write = trans.get_command() == tlm::TLM_WRITE_COMMAND;
+
+        if (trans.get_byte_enable_ptr() != 0
+            || trans.get_streaming_width() < trans.get_data_length())
+        {
+            return false;
+        }
+
+        for (const tlm::tlm_dmi& dmi : dmiRegions)
+        {
+            if (start < dmi.get_start_address()
+                || end > dmi.get_end_address()
+                || !(write ? dmi.is_write_allowed() : dmi.is_read_allowed()))
+            {
+                continue;
+            }
+
+            unsigned char *ptr = dmi.get_dmi_ptr()
+                               + (start - dmi.get_start_address());
+            if (write)
             {
-                checkValue(trans);
-            }        
+                memcpy(ptr, trans.get_data_ptr(), trans.get_data_length());
+                delay += dmi.get_write_latency();
+            }
+            else
+            {
+                memcpy(trans.get_data_ptr(), ptr, trans.get_data_length());
+                delay += dmi.get_read_latency();
+            }
+            trans.set_response_status(tlm::TLM_OK_RESPONSE);
+            return true;
+        }
+        return false;
+    }
 
-            // Allow the memory manager to free the transaction object
-            trans.release();
+    // TLM-2 backward DMI method
+    void invalidate_direct_mem_ptr(sc_dt::uint64 start_range,
+                                   sc_dt::uint64 end_range)
+    {
+        // Drop every cached region that overlaps the invalidated range
+        for (size_t i = 0; i < dmiRegions.size(); )
+        {
+            if (dmiRegions[i].get_start_address() <= end_range
+                && dmiRegions[i].get_end_address() >= start_range)
+            {
+                dmiRegions[i] = dmiRegions.back();
+                dmiRegions.pop_back();
+            }
+            else
+            {
+                i++;
+            }
         }
     }
 
@@ -215,7 +407,7 @@ SC_MODULE(processor)
         sc_time delay = SC_ZERO_TIME;            
         trans.set_command(tlm::TLM_READ_COMMAND);
         trans.set_data_ptr(data);
-        iSocket->b_transport(trans, delay);  
+        ltTransport(trans, delay);
 
         std::cout << "\033[1;31m"
                     << "(I) @"  << std::setfill(' ') << std::setw(12) << sc_time_stamp()
@@ -230,8 +422,6 @@ SC_MODULE(processor)
                 SC_REPORT_FATAL("processor", "Write operation failed");
             }
         }
-
-        free(data_expected);        
     }    
 
 };
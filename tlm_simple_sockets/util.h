@@ -42,4 +42,14 @@ sc_time randomDelay()
     return sc_time(nanoseconds, SC_NS);
 }
 
+// Phase sequences of the non-blocking transport, selectable in the
+// initiators and targets. The numbers refer to the base protocol examples.
+enum protocolMode
+{
+    FOUR_PHASE,       // BEGIN_REQ, END_REQ, BEGIN_RESP, END_RESP [1.x]
+    RETURN_PATH,      // END_REQ/END_RESP on the return path [2.0, 2.1]
+    EARLY_COMPLETION, // TLM_COMPLETED on BEGIN_REQ/BEGIN_RESP [3.0, 3.1]
+    SKIP_END_REQ      // BEGIN_RESP also ends the request phase [4.0]
+};
+
 #endif // UTIL_H